@@ -0,0 +1,282 @@
+// Host side of the stand-ins in host/include: nothing is pressed, nothing is shown,
+// the clocks run at the console's rates so the tick counts the checks report read the same
+#include <citro2d.h>
+
+#include <chrono>
+#include <cstring>
+
+void hidScanInput(void)
+{
+
+}
+u32 hidKeysDown(void)
+{
+    return 0;
+}
+u32 hidKeysHeld(void)
+{
+    return 0;
+}
+u32 hidKeysUp(void)
+{
+    return 0;
+}
+void hidTouchRead(touchPosition* pos)
+{
+    *pos = {};
+}
+void hidCircleRead(circlePosition* pos)
+{
+    *pos = {};
+}
+
+u64 osGetTime(void)
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+u64 svcGetSystemTick(void)
+{
+    using namespace std::chrono;
+    const u64 ns = duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+    // whole seconds apart, the product would overflow after a few hours of uptime
+    return (ns / 1000000000) * SYSCLOCK_ARM11 + (ns % 1000000000) * SYSCLOCK_ARM11 / 1000000000;
+}
+Result svcGetThreadId(u32* out, Handle handle)
+{
+    *out = 1;
+    return 0;
+}
+void svcBreak(int reason)
+{
+    abort();
+}
+
+void* linearAlloc(size_t size)
+{
+    return aligned_alloc(0x80, (size + 0x7F) & ~size_t(0x7F));
+}
+void linearFree(void* mem)
+{
+    free(mem);
+}
+
+Result romfsInit(void)
+{
+    return 0;
+}
+Result romfsExit(void)
+{
+    return 0;
+}
+void gfxInitDefault(void)
+{
+
+}
+void gfxExit(void)
+{
+
+}
+void consoleDebugInit(debugDevice device)
+{
+
+}
+
+bool aptMainLoop(void)
+{
+    return false;
+}
+void aptHook(aptHookCookie* cookie, aptHookFn callback, void* param)
+{
+    cookie->callback = callback;
+    cookie->param = param;
+}
+void aptUnhook(aptHookCookie* cookie)
+{
+
+}
+
+struct C3D_RenderTarget_tag {
+    C3D_Tex* tex;
+};
+
+bool C3D_Init(size_t cmdBufSize)
+{
+    return true;
+}
+void C3D_Fini(void)
+{
+
+}
+bool C3D_FrameBegin(u8 flags)
+{
+    return true;
+}
+void C3D_FrameEnd(u8 flags)
+{
+
+}
+float C3D_GetDrawingTime(void)
+{
+    return 0.0f;
+}
+float C3D_GetProcessingTime(void)
+{
+    return 0.0f;
+}
+
+bool C3D_TexInit(C3D_Tex* tex, u16 width, u16 height, GPU_TEXCOLOR format)
+{
+    *tex = {};
+    tex->fmt = format;
+    tex->width = width;
+    tex->height = height;
+    tex->size = width * height * 4;
+    tex->data = calloc(tex->size, 1);
+    return tex->data != nullptr;
+}
+bool C3D_TexInitVRAM(C3D_Tex* tex, u16 width, u16 height, GPU_TEXCOLOR format)
+{
+    return C3D_TexInit(tex, width, height, format);
+}
+void C3D_TexDelete(C3D_Tex* tex)
+{
+    free(tex->data);
+    tex->data = nullptr;
+}
+void C3D_TexFlush(C3D_Tex* tex)
+{
+
+}
+void C3D_TexUpload(C3D_Tex* tex, const void* data)
+{
+    memcpy(tex->data, data, tex->size);
+}
+void C3D_TexSetFilter(C3D_Tex* tex, GPU_TEXTURE_FILTER_PARAM magFilter, GPU_TEXTURE_FILTER_PARAM minFilter)
+{
+
+}
+
+C3D_RenderTarget* C3D_RenderTargetCreateFromTex(C3D_Tex* tex, GPU_TEXFACE face, int level, int depthFmt)
+{
+    return new C3D_RenderTarget{tex};
+}
+void C3D_RenderTargetDelete(C3D_RenderTarget* target)
+{
+    delete target;
+}
+
+void C3D_AlphaBlend(GPU_BLENDEQUATION colorEq, GPU_BLENDEQUATION alphaEq, GPU_BLENDFACTOR srcClr, GPU_BLENDFACTOR dstClr, GPU_BLENDFACTOR srcAlpha, GPU_BLENDFACTOR dstAlpha)
+{
+
+}
+
+bool C2D_Init(size_t maxObjects)
+{
+    return true;
+}
+void C2D_Fini(void)
+{
+
+}
+void C2D_Prepare(void)
+{
+
+}
+void C2D_Flush(void)
+{
+
+}
+
+C3D_RenderTarget* C2D_CreateScreenTarget(gfxScreen_t screen, gfx3dSide_t side)
+{
+    return new C3D_RenderTarget{nullptr};
+}
+void C2D_TargetClear(C3D_RenderTarget* target, u32 color)
+{
+
+}
+void C2D_SceneBegin(C3D_RenderTarget* target)
+{
+
+}
+
+// one 32x32 sprite per entry of the sheet, all in the same empty texture
+static constexpr size_t sheet_sprites = 64;
+static C3D_Tex sheet_tex;
+static Tex3DS_SubTexture sheet_subtex[sheet_sprites];
+
+C2D_SpriteSheet C2D_SpriteSheetLoad(const char* filename)
+{
+    if(!sheet_tex.data)
+        C3D_TexInit(&sheet_tex, 512, 512, GPU_RGBA8);
+    for(size_t i = 0; i < sheet_sprites; ++i)
+    {
+        const float x = (i % 16) * 32, y = (i / 16) * 32;
+        sheet_subtex[i] = {32, 32, x / 512, 1.0f - y / 512, (x + 32) / 512, 1.0f - (y + 32) / 512};
+    }
+    return reinterpret_cast<C2D_SpriteSheet>(&sheet_tex);
+}
+void C2D_SpriteSheetFree(C2D_SpriteSheet sheet)
+{
+    C3D_TexDelete(&sheet_tex);
+}
+size_t C2D_SpriteSheetCount(C2D_SpriteSheet sheet)
+{
+    return sheet_sprites;
+}
+C2D_Image C2D_SpriteSheetGetImage(C2D_SpriteSheet sheet, size_t index)
+{
+    return {&sheet_tex, &sheet_subtex[index]};
+}
+
+void C2D_PlainImageTint(C2D_ImageTint* tint, u32 color, float blend)
+{
+    for(auto& corner : tint->corners)
+        corner = {color, blend};
+}
+bool C2D_DrawImageAt(C2D_Image img, float x, float y, float depth, const C2D_ImageTint* tint, float scaleX, float scaleY)
+{
+    return true;
+}
+bool C2D_DrawRectSolid(float x, float y, float z, float w, float h, u32 clr)
+{
+    return true;
+}
+
+C2D_TextBuf C2D_TextBufNew(size_t maxGlyphs)
+{
+    return nullptr;
+}
+void C2D_TextBufDelete(C2D_TextBuf buf)
+{
+
+}
+void C2D_TextBufClear(C2D_TextBuf buf)
+{
+
+}
+const char* C2D_TextParse(C2D_Text* text, C2D_TextBuf buf, const char* str)
+{
+    *text = {};
+    text->buf = buf;
+    text->end = strlen(str);
+    text->width = text->end * 8.0f;
+    text->lines = 1;
+    return str + text->end;
+}
+void C2D_TextOptimize(const C2D_Text* text)
+{
+
+}
+void C2D_TextGetDimensions(const C2D_Text* text, float scaleX, float scaleY, float* outWidth, float* outHeight)
+{
+    if(outWidth)
+        *outWidth = text->width * scaleX;
+    if(outHeight)
+        *outHeight = 16.0f * scaleY;
+}
+void C2D_DrawText(const C2D_Text* text, u32 flags, float x, float y, float z, float scaleX, float scaleY, ...)
+{
+
+}
@@ -0,0 +1,127 @@
+// Stand-in for the parts of libctru the game uses, so it builds on the host (see host/Makefile)
+// Input, clocks and memory behave like the console's, everything to do with the screens does nothing
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef int64_t s64;
+typedef s32 Result;
+typedef u32 Handle;
+
+#define BIT(n) (1U<<(n))
+
+enum {
+    KEY_A       = BIT(0),
+    KEY_B       = BIT(1),
+    KEY_SELECT  = BIT(2),
+    KEY_START   = BIT(3),
+    KEY_DRIGHT  = BIT(4),
+    KEY_DLEFT   = BIT(5),
+    KEY_DUP     = BIT(6),
+    KEY_DDOWN   = BIT(7),
+    KEY_R       = BIT(8),
+    KEY_L       = BIT(9),
+    KEY_X       = BIT(10),
+    KEY_Y       = BIT(11),
+    KEY_ZL      = BIT(14),
+    KEY_ZR      = BIT(15),
+    KEY_TOUCH   = BIT(20),
+    KEY_CSTICK_RIGHT = BIT(24),
+    KEY_CSTICK_LEFT  = BIT(25),
+    KEY_CSTICK_UP    = BIT(26),
+    KEY_CSTICK_DOWN  = BIT(27),
+    KEY_CPAD_RIGHT = BIT(28),
+    KEY_CPAD_LEFT  = BIT(29),
+    KEY_CPAD_UP    = BIT(30),
+    KEY_CPAD_DOWN  = BIT(31),
+
+    KEY_UP    = KEY_DUP    | KEY_CPAD_UP,
+    KEY_DOWN  = KEY_DDOWN  | KEY_CPAD_DOWN,
+    KEY_LEFT  = KEY_DLEFT  | KEY_CPAD_LEFT,
+    KEY_RIGHT = KEY_DRIGHT | KEY_CPAD_RIGHT,
+};
+
+typedef struct {
+    u16 px, py;
+} touchPosition;
+
+typedef struct {
+    s16 dx, dy;
+} circlePosition;
+
+void hidScanInput(void);
+u32 hidKeysDown(void);
+u32 hidKeysHeld(void);
+u32 hidKeysUp(void);
+void hidTouchRead(touchPosition* pos);
+void hidCircleRead(circlePosition* pos);
+
+#define SYSCLOCK_ARM11 268111856LL
+#define CPU_TICKS_PER_MSEC (SYSCLOCK_ARM11 / 1000.0)
+#define CPU_TICKS_PER_USEC (SYSCLOCK_ARM11 / 1000000.0)
+
+u64 osGetTime(void);
+u64 svcGetSystemTick(void);
+
+#define CUR_THREAD_HANDLE 0xFFFF8000
+Result svcGetThreadId(u32* out, Handle handle);
+
+#define USERBREAK_PANIC 0
+void svcBreak(int reason);
+
+void* linearAlloc(size_t size);
+void linearFree(void* mem);
+
+Result romfsInit(void);
+Result romfsExit(void);
+
+typedef enum {
+    GFX_TOP,
+    GFX_BOTTOM,
+} gfxScreen_t;
+
+typedef enum {
+    GFX_LEFT,
+    GFX_RIGHT,
+} gfx3dSide_t;
+
+void gfxInitDefault(void);
+void gfxExit(void);
+
+typedef enum {
+    debugDevice_NULL,
+    debugDevice_SVC,
+    debugDevice_CONSOLE,
+} debugDevice;
+
+void consoleDebugInit(debugDevice device);
+
+typedef enum {
+    APTHOOK_ONSUSPEND,
+    APTHOOK_ONRESTORE,
+    APTHOOK_ONSLEEP,
+    APTHOOK_ONWAKEUP,
+    APTHOOK_ONEXIT,
+    APTHOOK_COUNT,
+} APT_HookType;
+
+typedef void (*aptHookFn)(APT_HookType hook, void* param);
+
+typedef struct tag_aptHookCookie {
+    struct tag_aptHookCookie* next;
+    aptHookFn callback;
+    void* param;
+} aptHookCookie;
+
+bool aptMainLoop(void);
+void aptHook(aptHookCookie* cookie, aptHookFn callback, void* param);
+void aptUnhook(aptHookCookie* cookie);
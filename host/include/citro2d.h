@@ -0,0 +1,70 @@
+// Stand-in for citro2d.h, see 3ds.h
+// Draw calls are accepted and dropped, text is measured as if every glyph were 8x16
+#pragma once
+
+#include "citro3d.h"
+#include "tex3ds.h"
+
+#define C2D_DEFAULT_MAX_OBJECTS 4096
+
+enum {
+    C2D_AtBaseline = BIT(0),
+    C2D_WithColor = BIT(1),
+    C2D_AlignLeft = 0,
+};
+
+constexpr u32 C2D_Color32(u8 r, u8 g, u8 b, u8 a)
+{
+    return r | (g << (u32)8) | (b << (u32)16) | (a << (u32)24);
+}
+
+typedef struct {
+    u32 color;
+    float blend;
+} C2D_Tint;
+
+typedef struct {
+    C2D_Tint corners[4];
+} C2D_ImageTint;
+
+typedef struct {
+    C3D_Tex* tex;
+    const Tex3DS_SubTexture* subtex;
+} C2D_Image;
+
+typedef struct C2D_SpriteSheet_s* C2D_SpriteSheet;
+typedef struct C2D_TextBuf_s* C2D_TextBuf;
+
+typedef struct {
+    C2D_TextBuf buf;
+    size_t begin, end;
+    float width;
+    u32 lines, words;
+    void* font;
+} C2D_Text;
+
+bool C2D_Init(size_t maxObjects);
+void C2D_Fini(void);
+void C2D_Prepare(void);
+void C2D_Flush(void);
+
+C3D_RenderTarget* C2D_CreateScreenTarget(gfxScreen_t screen, gfx3dSide_t side);
+void C2D_TargetClear(C3D_RenderTarget* target, u32 color);
+void C2D_SceneBegin(C3D_RenderTarget* target);
+
+C2D_SpriteSheet C2D_SpriteSheetLoad(const char* filename);
+void C2D_SpriteSheetFree(C2D_SpriteSheet sheet);
+size_t C2D_SpriteSheetCount(C2D_SpriteSheet sheet);
+C2D_Image C2D_SpriteSheetGetImage(C2D_SpriteSheet sheet, size_t index);
+
+void C2D_PlainImageTint(C2D_ImageTint* tint, u32 color, float blend);
+bool C2D_DrawImageAt(C2D_Image img, float x, float y, float depth, const C2D_ImageTint* tint = nullptr, float scaleX = 1.0f, float scaleY = 1.0f);
+bool C2D_DrawRectSolid(float x, float y, float z, float w, float h, u32 clr);
+
+C2D_TextBuf C2D_TextBufNew(size_t maxGlyphs);
+void C2D_TextBufDelete(C2D_TextBuf buf);
+void C2D_TextBufClear(C2D_TextBuf buf);
+const char* C2D_TextParse(C2D_Text* text, C2D_TextBuf buf, const char* str);
+void C2D_TextOptimize(const C2D_Text* text);
+void C2D_TextGetDimensions(const C2D_Text* text, float scaleX, float scaleY, float* outWidth, float* outHeight);
+void C2D_DrawText(const C2D_Text* text, u32 flags, float x, float y, float z, float scaleX, float scaleY, ...);
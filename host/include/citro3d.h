@@ -0,0 +1,67 @@
+// Stand-in for citro3d.h, see 3ds.h
+// Textures own zeroed memory of their real size, nothing is ever drawn into them
+#pragma once
+
+#include "3ds.h"
+
+typedef enum {
+    GPU_RGBA8 = 0,
+    GPU_RGB8,
+    GPU_RGBA5551,
+    GPU_RGB565,
+    GPU_RGBA4,
+} GPU_TEXCOLOR;
+
+typedef enum {
+    GPU_TEXFACE_2D = 0,
+} GPU_TEXFACE;
+
+typedef enum {
+    GPU_NEAREST = 0,
+    GPU_LINEAR = 1,
+} GPU_TEXTURE_FILTER_PARAM;
+
+typedef enum {
+    GPU_BLEND_ADD = 0,
+} GPU_BLENDEQUATION;
+
+typedef enum {
+    GPU_ZERO = 0,
+    GPU_ONE = 1,
+    GPU_SRC_ALPHA = 6,
+    GPU_ONE_MINUS_SRC_ALPHA = 7,
+} GPU_BLENDFACTOR;
+
+typedef struct {
+    void* data;
+    GPU_TEXCOLOR fmt;
+    size_t size;
+    u16 width, height;
+    u32 param;
+    u32 border;
+} C3D_Tex;
+
+typedef struct C3D_RenderTarget_tag C3D_RenderTarget;
+
+#define C3D_DEFAULT_CMDBUF_SIZE 0x40000
+#define C3D_FRAME_SYNCDRAW BIT(0)
+#define C3D_FRAME_NONBLOCK BIT(1)
+
+bool C3D_Init(size_t cmdBufSize);
+void C3D_Fini(void);
+bool C3D_FrameBegin(u8 flags);
+void C3D_FrameEnd(u8 flags);
+float C3D_GetDrawingTime(void);
+float C3D_GetProcessingTime(void);
+
+bool C3D_TexInit(C3D_Tex* tex, u16 width, u16 height, GPU_TEXCOLOR format);
+bool C3D_TexInitVRAM(C3D_Tex* tex, u16 width, u16 height, GPU_TEXCOLOR format);
+void C3D_TexDelete(C3D_Tex* tex);
+void C3D_TexFlush(C3D_Tex* tex);
+void C3D_TexUpload(C3D_Tex* tex, const void* data);
+void C3D_TexSetFilter(C3D_Tex* tex, GPU_TEXTURE_FILTER_PARAM magFilter, GPU_TEXTURE_FILTER_PARAM minFilter);
+
+C3D_RenderTarget* C3D_RenderTargetCreateFromTex(C3D_Tex* tex, GPU_TEXFACE face, int level, int depthFmt);
+void C3D_RenderTargetDelete(C3D_RenderTarget* target);
+
+void C3D_AlphaBlend(GPU_BLENDEQUATION colorEq, GPU_BLENDEQUATION alphaEq, GPU_BLENDFACTOR srcClr, GPU_BLENDFACTOR dstClr, GPU_BLENDFACTOR srcAlpha, GPU_BLENDFACTOR dstAlpha);
@@ -0,0 +1,9 @@
+// Stand-in for tex3ds.h, see 3ds.h
+#pragma once
+
+#include "3ds.h"
+
+typedef struct {
+    u16 width, height;
+    float left, top, right, bottom;
+} Tex3DS_SubTexture;
@@ -5,14 +5,19 @@
 #include <cstdio>
 #include <cstring>
 #include <cctype>
+#include <cmath>
 #include <vector>
 #include <map>
 #include <memory>
+#include <optional>
 #include <string>
 #include <fstream>
+#include <functional>
+#include <algorithm>
 
 #include <archive.h>
 #include <archive_entry.h>
+#include <zlib.h>
 
 #include "sprites.h"
 
@@ -27,6 +32,19 @@ static int number_of_bits(u32 i)
     return (((i + (i >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
 }
 
+// offset of a texel in a tiled (8x8 tiles, morton order inside) GPU texture
+static u32 texel_offset(u32 x, u32 y, u32 width)
+{
+    const u32 tile = ((y >> 3) * (width >> 3) + (x >> 3)) << 6;
+    const u32 morton = (x & 1) | ((y & 1) << 1) | ((x & 2) << 1) | ((y & 2) << 2) | ((x & 4) << 2) | ((y & 4) << 3);
+    return tile + morton;
+}
+// citro2d colors keep red in the low byte, RGBA8 texels keep it in the high one
+static u32 color_to_texel(u32 color, u8 alpha)
+{
+    return ((color & 0xff) << 24) | (((color >> 8) & 0xff) << 16) | (((color >> 16) & 0xff) << 8) | alpha;
+}
+
 struct FileCloser {
     void operator()(FILE* f)
     {
@@ -48,13 +66,31 @@ struct Tex {
     TargetPtr target;
     bool inited = false;
     bool drawn = false;
-    void create(u16 w, u16 h)
+    // textures the CPU writes to live in linear memory and can't be drawn into
+    // false when there was no memory left for it
+    bool create(u16 w, u16 h, bool render_target = true)
     {
-        if(inited) return;
+        if(inited) return true;
 
-        C3D_TexInitVRAM(&tex, w, h, GPU_RGBA8);
-        target.reset(C3D_RenderTargetCreateFromTex(&tex, GPU_TEXFACE_2D, 0, -1));
+        if(render_target)
+        {
+            if(!C3D_TexInitVRAM(&tex, w, h, GPU_RGBA8))
+                return false;
+            target.reset(C3D_RenderTargetCreateFromTex(&tex, GPU_TEXFACE_2D, 0, -1));
+            if(!target)
+            {
+                C3D_TexDelete(&tex);
+                return false;
+            }
+        }
+        else
+        {
+            if(!C3D_TexInit(&tex, w, h, GPU_RGBA8))
+                return false;
+            memset(tex.data, 0, tex.size);
+        }
         inited = true;
+        return true;
     }
     void clear()
     {
@@ -128,6 +164,336 @@ struct DataOwner {
     }
 };
 
+#ifdef COLORFILLER_PROFILER
+struct FrameProfiler {
+    enum Stage : int {
+        Update,
+        UpdateImages,
+        DrawTop,
+        DrawBottom,
+        FrameWait,
+        LevelDraw,
+        MoveBatch,
+        Analysis,
+        Assist,
+        GpuDraw,
+        Thumbnails,
+        Damage,
+
+        StageCount,
+    };
+    static constexpr const char* stage_names[StageCount] = {
+        "update",
+        "update_images",
+        "draw_top",
+        "draw_bottom",
+        "frame_wait",
+        "level_draw",
+        "move_batch",
+        "analysis",
+        "assist",
+        "gpu_draw",
+        "thumbnails",
+        "damage",
+    };
+    // running totals of events, for work that's better counted than timed
+    enum Counter : int {
+        PackScrollSteps,
+        PackNameRenders,
+        PreviewHits,
+        PreviewMisses,
+        PrefetchHits,
+        PrefetchMisses,
+
+        CounterCount,
+    };
+    static constexpr const char* counter_names[CounterCount] = {
+        "pack_scroll_steps",
+        "pack_name_renders",
+        "preview_hits",
+        "preview_misses",
+        "prefetch_hits",
+        "prefetch_misses",
+    };
+    // frames spent in each LevelContainer mode, by how many screens they drew
+    static constexpr int mode_count = 5;
+    static constexpr const char* mode_names[mode_count] = {
+        "no_file",
+        "error_loading",
+        "select_pack",
+        "select_level",
+        "play_level",
+    };
+    static constexpr const char dump_path[] = "/3ds/ColorFiller.profile.csv";
+    static constexpr size_t history_size = 240;
+
+    struct Stats {
+        float min, avg, max;
+    };
+
+    using FrameTicks = std::array<u32, StageCount>;
+    std::array<FrameTicks, history_size> history{};
+    size_t history_head = 0;
+    size_t history_filled = 0;
+    FrameTicks current{};
+    std::array<u32, CounterCount> counters{};
+    std::array<std::array<u32, 3>, mode_count> mode_frames{};
+    int last_mode = 0;
+    bool overlay = false;
+
+    void add(Stage stage, u64 ticks)
+    {
+        current[stage] += ticks;
+    }
+    void count(Counter counter, u32 n = 1)
+    {
+        counters[counter] += n;
+    }
+    void count_frame(int mode, int screens_drawn)
+    {
+        mode_frames[mode][screens_drawn]++;
+        last_mode = mode;
+    }
+    // the part of a mode's frames that drew no screen, and the part that only drew one
+    void idle_fractions(int mode, float& skipped, float& one_screen) const
+    {
+        const auto& f = mode_frames[mode];
+        const u32 total = f[0] + f[1] + f[2];
+        skipped = total ? float(f[0]) / total : 0.0f;
+        one_screen = total ? float(f[1]) / total : 0.0f;
+    }
+    void end_frame()
+    {
+        current[GpuDraw] = u32(C3D_GetDrawingTime() * CPU_TICKS_PER_MSEC);
+        history[history_head] = current;
+        history_head = (history_head + 1) % history_size;
+        if(history_filled < history_size)
+            history_filled++;
+        current.fill(0);
+    }
+
+    static float ticks_to_ms(u32 ticks)
+    {
+        return float(ticks / CPU_TICKS_PER_MSEC);
+    }
+    Stats stats(Stage stage) const
+    {
+        if(history_filled == 0) return Stats{0.0f, 0.0f, 0.0f};
+
+        u32 min = UINT32_MAX, max = 0;
+        u64 total = 0;
+        for(size_t i = 0; i < history_filled; ++i)
+        {
+            const u32 t = history[i][stage];
+            if(t < min) min = t;
+            if(t > max) max = t;
+            total += t;
+        }
+        return Stats{ticks_to_ms(min), ticks_to_ms(u32(total / history_filled)), ticks_to_ms(max)};
+    }
+
+    void dump() const
+    {
+        FilePtr fh(fopen(dump_path, "w"));
+        if(!fh)
+        {
+            DEBUGPRINT("profiler dump fopen %d\n", errno);
+            return;
+        }
+
+        for(int s = 0; s < StageCount; ++s)
+            fprintf(fh.get(), s == 0 ? "%s" : ",%s", stage_names[s]);
+        fputc('\n', fh.get());
+
+        // oldest frame first
+        const size_t first = history_filled == history_size ? history_head : 0;
+        for(size_t i = 0; i < history_filled; ++i)
+        {
+            const auto& frame = history[(first + i) % history_size];
+            for(int s = 0; s < StageCount; ++s)
+                fprintf(fh.get(), s == 0 ? "%.3f" : ",%.3f", ticks_to_ms(frame[s]));
+            fputc('\n', fh.get());
+        }
+        DEBUGPRINT("profiler dumped %zd frames\n", history_filled);
+        for(int c = 0; c < CounterCount; ++c)
+            DEBUGPRINT("profiler counter %s: %lu\n", counter_names[c], counters[c]);
+        for(int m = 0; m < mode_count; ++m)
+        {
+            float skipped, one_screen;
+            idle_fractions(m, skipped, one_screen);
+            DEBUGPRINT("profiler mode %s: %.1f%% of frames skipped, %.1f%% drew one screen\n", mode_names[m], skipped * 100.0f, one_screen * 100.0f);
+        }
+    }
+
+    void draw_overlay(C2D_TextBuf buf) const
+    {
+        if(!overlay) return;
+
+        constexpr float txt_scale = 0.5f;
+        constexpr float line_height = 12.0f;
+        C2D_TextBufClear(buf);
+        C2D_DrawRectSolid(0.0f, 0.0f, 0.9375f, 220.0f, line_height * (StageCount + CounterCount + 2) + 4.0f, C2D_Color32(0, 0, 0, 192));
+
+        C2D_Text txt;
+        char line[64];
+        C2D_TextParse(&txt, buf, "stage: min / avg / max (ms)");
+        C2D_DrawText(&txt, C2D_WithColor, 2.0f, 2.0f, 1.0f, txt_scale, txt_scale, C2D_Color32(255,255,255,255));
+        for(int s = 0; s < StageCount; ++s)
+        {
+            const auto st = stats(Stage(s));
+            snprintf(line, sizeof(line), "%s: %.2f / %.2f / %.2f", stage_names[s], st.min, st.avg, st.max);
+            C2D_TextParse(&txt, buf, line);
+            C2D_DrawText(&txt, C2D_WithColor, 2.0f, 2.0f + line_height * (s + 1), 1.0f, txt_scale, txt_scale, C2D_Color32(255,255,255,255));
+        }
+        for(int c = 0; c < CounterCount; ++c)
+        {
+            snprintf(line, sizeof(line), "%s: %lu", counter_names[c], counters[c]);
+            C2D_TextParse(&txt, buf, line);
+            C2D_DrawText(&txt, C2D_WithColor, 2.0f, 2.0f + line_height * (StageCount + c + 1), 1.0f, txt_scale, txt_scale, C2D_Color32(255,255,255,255));
+        }
+        float skipped, one_screen;
+        idle_fractions(last_mode, skipped, one_screen);
+        snprintf(line, sizeof(line), "%s: %.0f%% skipped, %.0f%% one screen", mode_names[last_mode], skipped * 100.0f, one_screen * 100.0f);
+        C2D_TextParse(&txt, buf, line);
+        C2D_DrawText(&txt, C2D_WithColor, 2.0f, 2.0f + line_height * (StageCount + CounterCount + 1), 1.0f, txt_scale, txt_scale, C2D_Color32(255,255,255,255));
+    }
+};
+static FrameProfiler profiler;
+
+struct ProfileScope {
+    FrameProfiler::Stage stage;
+    u64 start;
+    explicit ProfileScope(FrameProfiler::Stage s) : stage(s), start(svcGetSystemTick())
+    {
+
+    }
+    ~ProfileScope()
+    {
+        profiler.add(stage, svcGetSystemTick() - start);
+    }
+};
+#define PROFILE_SCOPE(stage) ProfileScope profile_scope_##stage(FrameProfiler::stage)
+#define PROFILE_COUNT(counter, ...) profiler.count(FrameProfiler::counter, ##__VA_ARGS__)
+#define PROFILE_FRAME(mode, screens_drawn) profiler.count_frame(mode, screens_drawn)
+#else
+#define PROFILE_SCOPE(stage)
+#define PROFILE_COUNT(counter, ...)
+#define PROFILE_FRAME(mode, screens_drawn)
+#endif
+
+#ifdef COLORFILLER_TRACE
+// Chrome JSON trace format, complete ("X") events only
+struct TraceRecorder {
+    static constexpr const char trace_path[] = "/3ds/ColorFiller.trace.json";
+    static constexpr size_t chunk_events = 1024;  // buffered, then appended to the file, so a long session doesn't grow the heap
+    static constexpr size_t detail_size = 48;  // longer details are cut
+
+    struct Event {
+        const char* name;
+        char detail[detail_size];
+        u64 start, duration;
+        u32 tid;
+    };
+    std::array<Event, chunk_events> events;
+    size_t count = 0, written = 0;
+    FilePtr fh;
+    bool open_failed = false;
+    u64 origin = svcGetSystemTick();
+
+    void add(const char* name, const std::string& detail, u64 start, u64 end)
+    {
+        if(count == events.size())
+            flush();
+
+        auto& e = events[count++];
+        e.name = name;
+        const size_t len = std::min(detail.size(), detail_size - 1);
+        memcpy(e.detail, detail.data(), len);
+        e.detail[len] = '\0';
+        e.start = start - origin;
+        e.duration = end - start;
+        e.tid = 0;
+        svcGetThreadId(&e.tid, CUR_THREAD_HANDLE);
+    }
+
+    static void write_escaped(FILE* f, const char* str)
+    {
+        for(; *str; ++str)
+        {
+            const char c = *str;
+            if(c == '"' || c == '\\')
+                fputc('\\', f);
+            if(u8(c) >= 0x20)
+                fputc(c, f);
+        }
+    }
+    // appends the buffered events to the file, opened on the first flush
+    void flush()
+    {
+        if(!fh && !open_failed)
+        {
+            fh.reset(fopen(trace_path, "w"));
+            if(!fh)
+            {
+                DEBUGPRINT("trace fopen %d\n", errno);
+                open_failed = true;
+            }
+            else
+            {
+                fputs("{\"traceEvents\":[\n", fh.get());
+            }
+        }
+        if(fh)
+        {
+            for(size_t i = 0; i < count; ++i)
+            {
+                const auto& e = events[i];
+                fprintf(fh.get(), "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f",
+                    written + i == 0 ? "" : ",\n", e.name, e.tid, e.start / CPU_TICKS_PER_USEC, e.duration / CPU_TICKS_PER_USEC);
+                if(e.detail[0])
+                {
+                    fputs(",\"args\":{\"detail\":\"", fh.get());
+                    TraceRecorder::write_escaped(fh.get(), e.detail);
+                    fputs("\"}", fh.get());
+                }
+                fputc('}', fh.get());
+            }
+            written += count;
+        }
+        count = 0;
+    }
+    void write()
+    {
+        flush();
+        if(!fh) return;
+
+        fputs("\n],\"displayTimeUnit\":\"ms\"}\n", fh.get());
+        fh.reset();
+        DEBUGPRINT("trace wrote %zd events\n", written);
+    }
+};
+static TraceRecorder tracer;
+
+struct TraceSpan {
+    const char* name;
+    std::string detail;
+    u64 start;
+    explicit TraceSpan(const char* n, std::string d = {}) : name(n), detail(std::move(d)), start(svcGetSystemTick())
+    {
+
+    }
+    ~TraceSpan()
+    {
+        tracer.add(name, detail, start, svcGetSystemTick());
+    }
+};
+#define TRACE_SPAN_CONCAT2(a, b) a##b
+#define TRACE_SPAN_CONCAT(a, b) TRACE_SPAN_CONCAT2(a, b)
+#define TRACE_SPAN(...) TraceSpan TRACE_SPAN_CONCAT(trace_span_, __LINE__)(__VA_ARGS__)
+#else
+#define TRACE_SPAN(...)
+#endif
+
 struct Config {
     static constexpr const char config_path[] = "/3ds/ColorFiller.conf";
 
@@ -135,6 +501,14 @@ struct Config {
 
     std::string levels_path = "/3ds/ColorFillerLevels.zip";
     std::string save_path = "/3ds/ColorFiller.sav";
+    std::string replay_record_path;  // empty: don't record
+    std::string replay_play_path;  // empty: play live
+    u32 key_repeat_delay = 300;  // milliseconds before a held direction repeats
+    u32 key_repeat_interval = 75;  // milliseconds between repeats
+    bool circle_pad_cursor = false;  // the circle pad moves the cursor instead of panning the board
+    bool fill_forced_moves = false;  // after each move, also make the moves the board leaves no choice about
+    static constexpr u32 max_preview_cache_kb = 2048;  // the tiles, screens and other textures need the rest of the 6MiB of VRAM
+    u32 preview_cache_kb = 1536;  // VRAM kept for level select previews, each one takes 256KiB
     u32 background_color = C2D_Color32(0,0,0,255);
     u32 highlight_color = C2D_Color32(192,192,192,255);
     u32 highlight_half_color = C2D_Color32(192,192,192,128);
@@ -226,6 +600,34 @@ struct Config {
                 {
                     save_path = value;
                 }
+                else if(key == "replay_record_path")
+                {
+                    replay_record_path = value;
+                }
+                else if(key == "replay_play_path")
+                {
+                    replay_play_path = value;
+                }
+                else if(key == "key_repeat_delay")
+                {
+                    key_repeat_delay = strtoul(value.c_str(), nullptr, 10);
+                }
+                else if(key == "key_repeat_interval")
+                {
+                    key_repeat_interval = strtoul(value.c_str(), nullptr, 10);
+                }
+                else if(key == "circle_pad")
+                {
+                    circle_pad_cursor = (value == "cursor");
+                }
+                else if(key == "forced_moves")
+                {
+                    fill_forced_moves = (value == "fill");
+                }
+                else if(key == "preview_cache_kb")
+                {
+                    preview_cache_kb = std::min<u32>(strtoul(value.c_str(), nullptr, 10), max_preview_cache_kb);
+                }
                 else if(key == "background_color")
                 {
                     background_color = Config::text_to_color(value);
@@ -263,6 +665,15 @@ struct Config {
         };
         writekv("levels_path", levels_path);
         writekv("save_path", save_path);
+        if(!replay_record_path.empty())
+            writekv("replay_record_path", replay_record_path);
+        if(!replay_play_path.empty())
+            writekv("replay_play_path", replay_play_path);
+        writekv("key_repeat_delay", std::to_string(key_repeat_delay));
+        writekv("key_repeat_interval", std::to_string(key_repeat_interval));
+        writekv("circle_pad", circle_pad_cursor ? "cursor" : "pan");
+        writekv("forced_moves", fill_forced_moves ? "fill" : "leave");
+        writekv("preview_cache_kb", std::to_string(preview_cache_kb));
         writekv("background_color", Config::color_to_str(background_color));
         writekv("interface_color", Config::color_to_str(interface_color));
         writekv("highlight_color", Config::color_to_str(highlight_color));
@@ -298,564 +709,2247 @@ struct Colors {
     }
 };
 
-struct SquareImages {
-    C2D_Image bridge_img;
-    C2D_Image bridge_inner_img;
-    C2D_Image square_img;
-    C2D_Image source_img;
-    C2D_Image coming_from_north_img;
-    C2D_Image coming_from_east_img;
-    C2D_Image coming_from_south_img;
-    C2D_Image coming_from_west_img;
-    C2D_Image coming_from_east_bridge_img;
-    C2D_Image coming_from_west_bridge_img;
-    C2D_Image wall_north_img;
-    C2D_Image wall_east_img;
-    C2D_Image wall_south_img;
-    C2D_Image wall_west_img;
-    C2D_Image hide_north_img;
-    C2D_Image hide_east_img;
-    C2D_Image hide_south_img;
-    C2D_Image hide_west_img;
-    std::array<C2D_Image, 26> indicators;
-
-    void set(C2D_SpriteSheet sprites)
-    {
-        bridge_img = C2D_SpriteSheetGetImage(sprites, sprites_bridge_idx);
-        bridge_inner_img = C2D_SpriteSheetGetImage(sprites, sprites_bridge_middle_clear_idx);
-        square_img = C2D_SpriteSheetGetImage(sprites, sprites_normal_square_idx);
-        source_img = C2D_SpriteSheetGetImage(sprites, sprites_source_idx);
-        coming_from_north_img = C2D_SpriteSheetGetImage(sprites, sprites_coming_from_north_idx);
-        coming_from_east_img = C2D_SpriteSheetGetImage(sprites, sprites_coming_from_east_idx);
-        coming_from_south_img = C2D_SpriteSheetGetImage(sprites, sprites_coming_from_south_idx);
-        coming_from_west_img = C2D_SpriteSheetGetImage(sprites, sprites_coming_from_west_idx);
-        coming_from_east_bridge_img = C2D_SpriteSheetGetImage(sprites, sprites_coming_from_east_bridge_idx);
-        coming_from_west_bridge_img = C2D_SpriteSheetGetImage(sprites, sprites_coming_from_west_bridge_idx);
-        wall_north_img = C2D_SpriteSheetGetImage(sprites, sprites_wall_north_idx);
-        wall_east_img = C2D_SpriteSheetGetImage(sprites, sprites_wall_east_idx);
-        wall_south_img = C2D_SpriteSheetGetImage(sprites, sprites_wall_south_idx);
-        wall_west_img = C2D_SpriteSheetGetImage(sprites, sprites_wall_west_idx);
-        hide_north_img = C2D_SpriteSheetGetImage(sprites, sprites_hide_north_idx);
-        hide_east_img = C2D_SpriteSheetGetImage(sprites, sprites_hide_east_idx);
-        hide_south_img = C2D_SpriteSheetGetImage(sprites, sprites_hide_south_idx);
-        hide_west_img = C2D_SpriteSheetGetImage(sprites, sprites_hide_west_idx);
-        for(int i = 0; i < 26; ++i)
-        {
-            indicators[i] = C2D_SpriteSheetGetImage(sprites, sprites_letter_A_idx + i);
-        }
-    }
+// Abstracts the draw calls so the same drawing code can go to citro2d or be recorded
+struct Renderer {
+    virtual ~Renderer() = default;
+
+    virtual void sprite(u16 sprite_idx, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x = 1.0f, float scale_y = 1.0f) = 0;
+    virtual void image(C2D_Image img, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x = 1.0f, float scale_y = 1.0f) = 0;
+    virtual void rect(float x, float y, float depth, float w, float h, u32 color) = 0;
+    virtual void text(const C2D_Text& txt, float x, float y, float depth, float scale_x, float scale_y, u32 color) = 0;
+    // makes the pixels transparent again instead of blending over them
+    virtual void erase(float x, float y, float w, float h) = 0;
 };
 
-enum Direction : u8 {
-    DIR_NORTH = 1,
-    DIR_EAST = 2,
-    DIR_SOUTH = 4,
-    DIR_WEST = 8,
+struct C2DRenderer final : Renderer {
+    std::vector<C2D_Image> images;
 
-    ALL_DIRS = (DIR_NORTH | DIR_EAST | DIR_SOUTH | DIR_WEST)
-};
-struct Square {
-    u8 color;
-    u8 direction : 4;
-    u8 walls : 4;
-    u8 hole : 1;
-    u8 source : 1;
-    u8 bridge : 1;
-    u8 bridge_above_direction : 2;  // 0: none 1: coming left 2: coming right 3: bridge full
-    u8 padding : 3;
-    u8 bridge_above_color;
+    explicit C2DRenderer(C2D_SpriteSheet sheet) : images(C2D_SpriteSheetCount(sheet))
+    {
+        for(size_t i = 0; i < images.size(); ++i)
+            images[i] = C2D_SpriteSheetGetImage(sheet, i);
+    }
 
-    bool is_source() const
+    void sprite(u16 sprite_idx, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
     {
-        return source;
+        C2D_DrawImageAt(images[sprite_idx], x, y, depth, tint, scale_x, scale_y);
     }
-    bool is_connected() const
+    void image(C2D_Image img, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
     {
-        return direction != 0;
+        C2D_DrawImageAt(img, x, y, depth, tint, scale_x, scale_y);
     }
-    u32 connection_count() const
+    void rect(float x, float y, float depth, float w, float h, u32 color) override
     {
-        return number_of_bits(direction);
+        C2D_DrawRectSolid(x, y, depth, w, h, color);
     }
-    u32 bridge_above_conn_count() const
+    void text(const C2D_Text& txt, float x, float y, float depth, float scale_x, float scale_y, u32 color) override
     {
-        if(bridge_above_direction == 3)
-            return 2;
-        else if(bridge_above_direction == 0)
-            return 0;
-        return 1;
+        C2D_DrawText(&txt, C2D_WithColor, x, y, depth, scale_x, scale_y, color);
     }
-
-    void draw(float px, float py, Colors& tints, SquareImages& imgs) const
+    void erase(float x, float y, float w, float h) override
     {
-        C2D_DrawImageAt(imgs.square_img, px, py, 0.125f, &tints.interface_tint);
-        int color_idx = color - 1;
-
-        if(color_idx != -1)
-        {
-            if(direction & DIR_NORTH)
-                C2D_DrawImageAt(imgs.coming_from_north_img, px, py, 0.25f, &tints.colors_tints[color_idx]);
-            if(direction & DIR_EAST)
-                C2D_DrawImageAt(imgs.coming_from_east_img, px, py, 0.25f, &tints.colors_tints[color_idx]);
-            if(direction & DIR_SOUTH)
-                C2D_DrawImageAt(imgs.coming_from_south_img, px, py, 0.25f, &tints.colors_tints[color_idx]);
-            if(direction & DIR_WEST)
-                C2D_DrawImageAt(imgs.coming_from_west_img, px, py, 0.25f, &tints.colors_tints[color_idx]);
-        }
-
-        if(is_source())
-        {
-            C2D_DrawImageAt(imgs.source_img, px, py, 0.375f, &tints.colors_tints[color_idx]);
-            C2D_DrawImageAt(imgs.indicators[color_idx], px, py, 0.5f, &tints.background_tint);
-        }
+        // what is already batched goes out with the blending it was made for
+        C2D_Flush();
+        C3D_AlphaBlend(GPU_BLEND_ADD, GPU_BLEND_ADD, GPU_ONE, GPU_ZERO, GPU_ONE, GPU_ZERO);
+        C2D_DrawRectSolid(x, y, 0.0f, w, h, Config::transparent_color);
+        C2D_Flush();
+        // back to the blending C2D_Prepare sets
+        C3D_AlphaBlend(GPU_BLEND_ADD, GPU_BLEND_ADD, GPU_SRC_ALPHA, GPU_ONE_MINUS_SRC_ALPHA, GPU_SRC_ALPHA, GPU_ONE_MINUS_SRC_ALPHA);
+    }
+};
 
-        if(bridge)
-        {
-            C2D_DrawImageAt(imgs.bridge_img, px, py, 0.25f, &tints.interface_tint);
-            C2D_DrawImageAt(imgs.bridge_inner_img, px, py, 0.375f, &tints.background_tint);
-            if(bridge_above_direction & 1)
-                C2D_DrawImageAt(imgs.coming_from_west_bridge_img, px, py, 0.5f, &tints.colors_tints[bridge_above_color - 1]);
-            if(bridge_above_direction & 2)
-                C2D_DrawImageAt(imgs.coming_from_east_bridge_img, px, py, 0.5f, &tints.colors_tints[bridge_above_color - 1]);
-        }
+// Only keeps a log of the commands, doesn't touch the GPU
+struct RecordingRenderer final : Renderer {
+    enum class Kind : u8 {
+        Sprite,
+        Image,
+        Rect,
+        Text,
+        Erase,
+    };
+    static constexpr u16 no_sprite = 0xFFFF;
+
+    struct Command {
+        Kind kind;
+        u16 sprite;
+        u32 tint;  // 0 when untinted
+        float x, y, depth;
+        u32 objects;  // citro2d objects (quads) this command costs
+    };
+    std::vector<Command> commands;
+    size_t object_count = 0;
 
-        if(walls & DIR_NORTH)
-            C2D_DrawImageAt(imgs.wall_north_img, px - 1.0f, py - 1.0f, 0.25f, &tints.interface_tint);
-        if(walls & DIR_EAST)
-            C2D_DrawImageAt(imgs.wall_east_img, px - 1.0f, py - 1.0f, 0.25f, &tints.interface_tint);
-        if(walls & DIR_SOUTH)
-            C2D_DrawImageAt(imgs.wall_south_img, px - 1.0f, py - 1.0f, 0.25f, &tints.interface_tint);
-        if(walls & DIR_WEST)
-            C2D_DrawImageAt(imgs.wall_west_img, px - 1.0f, py - 1.0f, 0.25f, &tints.interface_tint);
+    void reset()
+    {
+        commands.clear();
+        object_count = 0;
     }
-
-    bool complete() const
+    void add(Kind kind, u16 sprite_idx, u32 tint, float x, float y, float depth, u32 objects)
     {
-        if(hole)
-            return true;
-        else if(is_source() && is_connected())
-            return true;
-        else if(connection_count() == 2)
-        {
-            if(bridge) return bridge_above_direction == 3;
-            return true;
-        }
-        return false;
+        commands.push_back(Command{kind, sprite_idx, tint, x, y, depth, objects});
+        object_count += objects;
     }
 
-    void add_direction_color(u8 dir, u8 col)
+    void sprite(u16 sprite_idx, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
     {
-        if(bridge)
-        {
-            if(dir == DIR_EAST)
-            {
-                bridge_above_direction |= 2;
-                bridge_above_color = col;
-            }
-            else if(dir == DIR_WEST)
-            {
-                bridge_above_direction |= 1;
-                bridge_above_color = col;
-            }
-            else
-            {
-                direction |= dir;
-                color = col;
-            }
-        }
-        else
-        {
-            direction |= dir;
-            color = col;
-        }
+        add(Kind::Sprite, sprite_idx, tint ? tint->corners[0].color : 0, x, y, depth, 1);
     }
-    void load_from(u16 v)
+    void image(C2D_Image img, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
     {
-        direction = (v & 0xF);
-        color = (v & (0x1F << 4)) >> 4;
-        if(bridge)
-        {
-            bridge_above_direction = (v & (0x3 << (5 + 4))) >> (5 + 4);
-            bridge_above_color = (v & (0x1F << (2 + 5 + 4))) >> (2 +5 + 4);
-        }
+        add(Kind::Image, no_sprite, tint ? tint->corners[0].color : 0, x, y, depth, 1);
     }
-
-    u16 pack_into() const
+    void rect(float x, float y, float depth, float w, float h, u32 color) override
     {
-        u16 out = 0;
-        out |= (direction & 0xF);
-        out |= (color & 0x1F) << 4;
-        if(bridge)
-        {
-            out |= (bridge_above_direction & 0x3) << (5 + 4);
-            out |= (bridge_above_color & 0x1F) << (2 + 5 + 4);
-        }
-        return out;
+        add(Kind::Rect, no_sprite, color, x, y, depth, 1);
+    }
+    void text(const C2D_Text& txt, float x, float y, float depth, float scale_x, float scale_y, u32 color) override
+    {
+        add(Kind::Text, no_sprite, color, x, y, depth, txt.end - txt.begin);
+    }
+    void erase(float x, float y, float w, float h) override
+    {
+        add(Kind::Erase, no_sprite, 0, x, y, 0.0f, 1);
     }
 };
 
-struct Level {
-    struct WallInfo {
-        u16 square;
-        u8 blocked_directions;
-    };
+// Draws through another renderer with every position moved to a new origin and scaled,
+// to render boards at a reduced size or one part of a board at a time
+struct ScaledRenderer final : Renderer {
+    Renderer& inner;
+    const float sx, sy;
+    const float ox, oy;
 
-    const u8 width, height, color_count;
-    const bool warp;
-    std::vector<Square> squares;
+    ScaledRenderer(Renderer& r, float scale_x, float scale_y, float origin_x = 0.0f, float origin_y = 0.0f) : inner(r), sx(scale_x), sy(scale_y), ox(origin_x), oy(origin_y)
+    {
 
-    bool square_is_top_row(u16 idx)
+    }
+
+    void sprite(u16 sprite_idx, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
     {
-        return idx < width;
+        inner.sprite(sprite_idx, (x - ox) * sx, (y - oy) * sy, depth, tint, scale_x * sx, scale_y * sy);
     }
-    bool square_is_bottom_row(u16 idx)
+    void image(C2D_Image img, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
     {
-        return idx >= ((height - 1) * width);
+        inner.image(img, (x - ox) * sx, (y - oy) * sy, depth, tint, scale_x * sx, scale_y * sy);
     }
-    bool square_is_left_column(u16 idx)
+    void rect(float x, float y, float depth, float w, float h, u32 color) override
     {
-        return (idx % width) == 0;
+        inner.rect((x - ox) * sx, (y - oy) * sy, depth, w * sx, h * sy, color);
     }
-    bool square_is_right_column(u16 idx)
+    void text(const C2D_Text& txt, float x, float y, float depth, float scale_x, float scale_y, u32 color) override
     {
-        return (idx % width) == (width - 1);
+        inner.text(txt, (x - ox) * sx, (y - oy) * sy, depth, scale_x * sx, scale_y * sy, color);
     }
+    void erase(float x, float y, float w, float h) override
+    {
+        inner.erase((x - ox) * sx, (y - oy) * sy, w * sx, h * sy);
+    }
+};
+
+// Forwards to another renderer, or only hashes what would have been drawn
+// Two equal hashes mean the screen would get the same commands, so it can keep its last picture
+struct DamageRenderer final : Renderer {
+    Renderer& inner;
+    bool hashing = false;
+    u32 hash = 0;
+
+    DamageRenderer(Renderer& r) : inner(r)
+    {
+
+    }
+
+    void start_hash(u32 seed)
+    {
+        hashing = true;
+        hash = 2166136261u;
+        add(seed);
+    }
+    u32 end_hash()
+    {
+        hashing = false;
+        return hash;
+    }
+
+    // FNV-1a over the bytes of the value
+    template<typename T>
+    void add(const T& value)
+    {
+        const u8* bytes = reinterpret_cast<const u8*>(&value);
+        for(size_t i = 0; i < sizeof(T); ++i)
+            hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    void add_tint(const C2D_ImageTint* tint)
+    {
+        add(tint != nullptr);
+        if(tint)
+        {
+            for(const auto& corner : tint->corners)
+            {
+                add(corner.color);
+                add(corner.blend);
+            }
+        }
+    }
+
+    void sprite(u16 sprite_idx, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
+    {
+        if(!hashing) return inner.sprite(sprite_idx, x, y, depth, tint, scale_x, scale_y);
+        add(u8(0));
+        add(sprite_idx); add(x); add(y); add(depth); add(scale_x); add(scale_y);
+        add_tint(tint);
+    }
+    void image(C2D_Image img, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
+    {
+        if(!hashing) return inner.image(img, x, y, depth, tint, scale_x, scale_y);
+        // the subtexture is often a local, its contents are what matters
+        add(u8(1));
+        add(img.tex);
+        add(img.subtex->width); add(img.subtex->height);
+        add(img.subtex->left); add(img.subtex->top); add(img.subtex->right); add(img.subtex->bottom);
+        add(x); add(y); add(depth); add(scale_x); add(scale_y);
+        add_tint(tint);
+    }
+    void rect(float x, float y, float depth, float w, float h, u32 color) override
+    {
+        if(!hashing) return inner.rect(x, y, depth, w, h, color);
+        add(u8(2));
+        add(x); add(y); add(depth); add(w); add(h); add(color);
+    }
+    void text(const C2D_Text& txt, float x, float y, float depth, float scale_x, float scale_y, u32 color) override
+    {
+        if(!hashing) return inner.text(txt, x, y, depth, scale_x, scale_y, color);
+        // parsed text only points into its buffer, the glyph range identifies it
+        add(u8(3));
+        add(txt.buf); add(txt.begin); add(txt.end);
+        add(x); add(y); add(depth); add(scale_x); add(scale_y); add(color);
+    }
+    void erase(float x, float y, float w, float h) override
+    {
+        if(!hashing) return inner.erase(x, y, w, h);
+        add(u8(4));
+        add(x); add(y); add(w); add(h);
+    }
+};
+
+#ifdef COLORFILLER_RASTER
+// Composites sprites on the CPU the way citro2d does in a render target (painter's order, no depth buffer)
+// Only sprites and rectangles are supported, which is everything Level::draw needs
+struct RasterRenderer final : Renderer {
+    const std::vector<C2D_Image>& images;
+    const u16 width, height;
+    std::vector<u8> pixels;  // RGBA, top row first
+    size_t skipped = 0;
+
+    RasterRenderer(const std::vector<C2D_Image>& imgs, u16 w, u16 h) : images(imgs), width(w), height(h), pixels(w * h * 4)
+    {
+
+    }
+
+    void clear(u32 color)
+    {
+        for(size_t i = 0; i < pixels.size(); i += 4)
+        {
+            pixels[i + 0] = color & 0xff;
+            pixels[i + 1] = (color >> 8) & 0xff;
+            pixels[i + 2] = (color >> 16) & 0xff;
+            pixels[i + 3] = (color >> 24) & 0xff;
+        }
+    }
+
+    // same blending as citro2d: src alpha, one minus src alpha, on colour and alpha
+    void blend(int x, int y, u8 r, u8 g, u8 b, u8 a)
+    {
+        if(x < 0 || y < 0 || x >= width || y >= height || a == 0) return;
+
+        u8* dst = &pixels[(y * width + x) * 4];
+        const u32 inv = 255 - a;
+        dst[0] = (r * a + dst[0] * inv) / 255;
+        dst[1] = (g * a + dst[1] * inv) / 255;
+        dst[2] = (b * a + dst[2] * inv) / 255;
+        dst[3] = (a * a + dst[3] * inv) / 255;
+    }
+
+    void sprite(u16 sprite_idx, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
+    {
+        const C2D_Image& img = images[sprite_idx];
+        const C3D_Tex* tex = img.tex;
+        const Tex3DS_SubTexture* sub = img.subtex;
+        const u32* texels = static_cast<const u32*>(tex->data);
+        const int dst_w = int(sub->width * scale_x);
+        const int dst_h = int(sub->height * scale_y);
+        const int origin_x = int(x);
+        const int origin_y = int(y);
+        const u32 tint_color = tint ? tint->corners[0].color : 0;
+
+        for(int dy = 0; dy < dst_h; ++dy)
+        {
+            // texture rows are stored bottom up, v = 1 is the top of the sheet
+            const float v = sub->top + (dy + 0.5f) / dst_h * (sub->bottom - sub->top);
+            const u32 ty = u32(v * tex->height);
+            for(int dx = 0; dx < dst_w; ++dx)
+            {
+                const float u = sub->left + (dx + 0.5f) / dst_w * (sub->right - sub->left);
+                const u32 tx = u32(u * tex->width);
+                const u32 texel = texels[texel_offset(tx, ty, tex->width)];  // 0xRRGGBBAA
+                u8 a = texel & 0xff;
+                u8 r = texel >> 24, g = (texel >> 16) & 0xff, b = (texel >> 8) & 0xff;
+                if(tint)
+                {
+                    r = tint_color & 0xff;
+                    g = (tint_color >> 8) & 0xff;
+                    b = (tint_color >> 16) & 0xff;
+                    a = (a * ((tint_color >> 24) & 0xff)) / 255;
+                }
+                blend(origin_x + dx, origin_y + dy, r, g, b, a);
+            }
+        }
+    }
+    void image(C2D_Image img, float x, float y, float depth, const C2D_ImageTint* tint, float scale_x, float scale_y) override
+    {
+        skipped++;
+    }
+    void rect(float x, float y, float depth, float w, float h, u32 color) override
+    {
+        const int x0 = int(x), y0 = int(y);
+        const int x1 = int(x + w), y1 = int(y + h);
+        for(int py = y0; py < y1; ++py)
+        {
+            for(int px = x0; px < x1; ++px)
+            {
+                blend(px, py, color & 0xff, (color >> 8) & 0xff, (color >> 16) & 0xff, color >> 24);
+            }
+        }
+    }
+    void text(const C2D_Text& txt, float x, float y, float depth, float scale_x, float scale_y, u32 color) override
+    {
+        skipped++;
+    }
+    void erase(float x, float y, float w, float h) override
+    {
+        const int x0 = std::max(0, int(x)), y0 = std::max(0, int(y));
+        const int x1 = std::min(int(width), int(x + w)), y1 = std::min(int(height), int(y + h));
+        for(int py = y0; py < y1; ++py)
+        {
+            if(x0 < x1)
+                memset(&pixels[(py * width + x0) * 4], 0, (x1 - x0) * 4);
+        }
+    }
+
+    bool write_png(const char* path) const
+    {
+        auto write_chunk = [](FILE* f, const char* type, const u8* data, u32 size) {
+            const u8 size_be[4] = {u8(size >> 24), u8(size >> 16), u8(size >> 8), u8(size)};
+            fwrite(size_be, 1, 4, f);
+            u32 crc = crc32(0, reinterpret_cast<const Bytef*>(type), 4);
+            if(size)
+                crc = crc32(crc, data, size);
+            fwrite(type, 1, 4, f);
+            if(size)
+                fwrite(data, 1, size, f);
+            const u8 crc_be[4] = {u8(crc >> 24), u8(crc >> 16), u8(crc >> 8), u8(crc)};
+            fwrite(crc_be, 1, 4, f);
+        };
+
+        // each row is prefixed by its filter type (0, none)
+        std::vector<u8> raw;
+        raw.reserve((width * 4 + 1) * height);
+        for(u16 y = 0; y < height; ++y)
+        {
+            raw.push_back(0);
+            raw.insert(raw.end(), pixels.begin() + y * width * 4, pixels.begin() + (y + 1) * width * 4);
+        }
+        uLongf compressed_size = compressBound(raw.size());
+        std::vector<u8> compressed(compressed_size);
+        if(compress2(compressed.data(), &compressed_size, raw.data(), raw.size(), Z_BEST_SPEED) != Z_OK)
+            return false;
+
+        FilePtr fh(fopen(path, "wb"));
+        if(!fh)
+        {
+            DEBUGPRINT("png fopen %d\n", errno);
+            return false;
+        }
+
+        static constexpr u8 signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        fwrite(signature, 1, sizeof(signature), fh.get());
+        const u8 header[13] = {
+            u8(width >> 24), u8(width >> 16), u8(width >> 8), u8(width),
+            u8(height >> 24), u8(height >> 16), u8(height >> 8), u8(height),
+            8, 6, 0, 0, 0,  // 8 bits per channel, RGBA, deflate, no filter, no interlace
+        };
+        write_chunk(fh.get(), "IHDR", header, sizeof(header));
+        write_chunk(fh.get(), "IDAT", compressed.data(), compressed_size);
+        write_chunk(fh.get(), "IEND", nullptr, 0);
+        return true;
+    }
+};
+#endif
+
+struct SquareImages {
+    u16 bridge_img = sprites_bridge_idx;
+    u16 bridge_inner_img = sprites_bridge_middle_clear_idx;
+    u16 square_img = sprites_normal_square_idx;
+    u16 source_img = sprites_source_idx;
+    u16 coming_from_north_img = sprites_coming_from_north_idx;
+    u16 coming_from_east_img = sprites_coming_from_east_idx;
+    u16 coming_from_south_img = sprites_coming_from_south_idx;
+    u16 coming_from_west_img = sprites_coming_from_west_idx;
+    u16 coming_from_east_bridge_img = sprites_coming_from_east_bridge_idx;
+    u16 coming_from_west_bridge_img = sprites_coming_from_west_bridge_idx;
+    u16 wall_north_img = sprites_wall_north_idx;
+    u16 wall_east_img = sprites_wall_east_idx;
+    u16 wall_south_img = sprites_wall_south_idx;
+    u16 wall_west_img = sprites_wall_west_idx;
+    u16 hide_north_img = sprites_hide_north_idx;
+    u16 hide_east_img = sprites_hide_east_idx;
+    u16 hide_south_img = sprites_hide_south_idx;
+    u16 hide_west_img = sprites_hide_west_idx;
+    std::array<u16, 26> indicators;
+
+    SquareImages()
+    {
+        for(int i = 0; i < 26; ++i)
+        {
+            indicators[i] = sprites_letter_A_idx + i;
+        }
+    }
+};
+
+enum Direction : u8 {
+    DIR_NORTH = 1,
+    DIR_EAST = 2,
+    DIR_SOUTH = 4,
+    DIR_WEST = 8,
+
+    ALL_DIRS = (DIR_NORTH | DIR_EAST | DIR_SOUTH | DIR_WEST)
+};
+// how the squares a path goes straight through are drawn
+enum class PathStyle : u8 {
+    Arms,  // both arm sprites, their rounded ends overlap a little in the middle
+    Bands,  // one rectangle across the square
+    Runs,  // not at all, the board draws one rectangle over each run of them
+};
+struct Square {
+    u8 color;
+    u8 direction : 4;
+    u8 walls : 4;
+    u8 hole : 1;
+    u8 source : 1;
+    u8 bridge : 1;
+    u8 bridge_above_direction : 2;  // 0: none 1: coming left 2: coming right 3: bridge full
+    u8 padding : 3;
+    u8 bridge_above_color;
+
+    bool is_source() const
+    {
+        return source;
+    }
+    bool is_connected() const
+    {
+        return direction != 0;
+    }
+    u32 connection_count() const
+    {
+        return number_of_bits(direction);
+    }
+    u32 bridge_above_conn_count() const
+    {
+        if(bridge_above_direction == 3)
+            return 2;
+        else if(bridge_above_direction == 0)
+            return 0;
+        return 1;
+    }
+    // the two directions of a path going straight through, 0 if it turns, ends or crosses a bridge here
+    u8 straight_axis() const
+    {
+        if(bridge || is_source() || color == 0) return 0;
+        if(direction == (DIR_NORTH | DIR_SOUTH) || direction == (DIR_EAST | DIR_WEST))
+            return direction;
+        return 0;
+    }
+
+    // the part of the arm sprites along the axis, over length pixels: the middle 4 pixels across
+    static void draw_band(Renderer& r, float px, float py, u8 axis, float length, const C2D_ImageTint& tint)
+    {
+        if(axis & DIR_NORTH)
+            r.rect(px + 6.0f, py, 0.25f, 4.0f, length, tint.corners[0].color);
+        else
+            r.rect(px, py + 6.0f, 0.25f, length, 4.0f, tint.corners[0].color);
+    }
+
+    void draw(Renderer& r, float px, float py, Colors& tints, SquareImages& imgs, PathStyle style = PathStyle::Bands) const
+    {
+        r.sprite(imgs.square_img, px, py, 0.125f, &tints.interface_tint);
+        int color_idx = color - 1;
+
+        const u8 axis = (style == PathStyle::Arms) ? 0 : straight_axis();
+        if(axis)
+        {
+            if(style == PathStyle::Bands)
+                draw_band(r, px, py, axis, 16.0f, tints.colors_tints[color_idx]);
+        }
+        else if(color_idx != -1)
+        {
+            if(direction & DIR_NORTH)
+                r.sprite(imgs.coming_from_north_img, px, py, 0.25f, &tints.colors_tints[color_idx]);
+            if(direction & DIR_EAST)
+                r.sprite(imgs.coming_from_east_img, px, py, 0.25f, &tints.colors_tints[color_idx]);
+            if(direction & DIR_SOUTH)
+                r.sprite(imgs.coming_from_south_img, px, py, 0.25f, &tints.colors_tints[color_idx]);
+            if(direction & DIR_WEST)
+                r.sprite(imgs.coming_from_west_img, px, py, 0.25f, &tints.colors_tints[color_idx]);
+        }
+
+        if(is_source())
+        {
+            r.sprite(imgs.source_img, px, py, 0.375f, &tints.colors_tints[color_idx]);
+            r.sprite(imgs.indicators[color_idx], px, py, 0.5f, &tints.background_tint);
+        }
+
+        if(bridge)
+        {
+            r.sprite(imgs.bridge_img, px, py, 0.25f, &tints.interface_tint);
+            r.sprite(imgs.bridge_inner_img, px, py, 0.375f, &tints.background_tint);
+            if(bridge_above_direction & 1)
+                r.sprite(imgs.coming_from_west_bridge_img, px, py, 0.5f, &tints.colors_tints[bridge_above_color - 1]);
+            if(bridge_above_direction & 2)
+                r.sprite(imgs.coming_from_east_bridge_img, px, py, 0.5f, &tints.colors_tints[bridge_above_color - 1]);
+        }
+
+        draw_walls(r, px, py, tints, imgs, walls);
+    }
+    // wall sprites are 18x18 and overhang the square by a pixel, which filtering can reach when scaled
+    void draw_walls(Renderer& r, float px, float py, Colors& tints, SquareImages& imgs, u8 which) const
+    {
+        if(which & DIR_NORTH)
+            r.sprite(imgs.wall_north_img, px - 1.0f, py - 1.0f, 0.25f, &tints.interface_tint);
+        if(which & DIR_EAST)
+            r.sprite(imgs.wall_east_img, px - 1.0f, py - 1.0f, 0.25f, &tints.interface_tint);
+        if(which & DIR_SOUTH)
+            r.sprite(imgs.wall_south_img, px - 1.0f, py - 1.0f, 0.25f, &tints.interface_tint);
+        if(which & DIR_WEST)
+            r.sprite(imgs.wall_west_img, px - 1.0f, py - 1.0f, 0.25f, &tints.interface_tint);
+    }
+
+    bool complete() const
+    {
+        if(hole)
+            return true;
+        else if(is_source() && is_connected())
+            return true;
+        else if(connection_count() == 2)
+        {
+            if(bridge) return bridge_above_direction == 3;
+            return true;
+        }
+        return false;
+    }
+
+    void add_direction_color(u8 dir, u8 col)
+    {
+        if(bridge)
+        {
+            if(dir == DIR_EAST)
+            {
+                bridge_above_direction |= 2;
+                bridge_above_color = col;
+            }
+            else if(dir == DIR_WEST)
+            {
+                bridge_above_direction |= 1;
+                bridge_above_color = col;
+            }
+            else
+            {
+                direction |= dir;
+                color = col;
+            }
+        }
+        else
+        {
+            direction |= dir;
+            color = col;
+        }
+    }
+    void load_from(u16 v)
+    {
+        direction = (v & 0xF);
+        color = (v & (0x1F << 4)) >> 4;
+        if(bridge)
+        {
+            bridge_above_direction = (v & (0x3 << (5 + 4))) >> (5 + 4);
+            bridge_above_color = (v & (0x1F << (2 + 5 + 4))) >> (2 +5 + 4);
+        }
+    }
+
+    // the colors a packed square holds, with their bit (color - 1) set
+    static u32 packed_colors(u16 v)
+    {
+        u32 colors = 0;
+        if(const u8 color = (v & (0x1F << 4)) >> 4)
+            colors |= 1u << (color - 1);
+        if(const u8 above = (v & (0x1F << (2 + 5 + 4))) >> (2 + 5 + 4))
+            colors |= 1u << (above - 1);
+        return colors;
+    }
+    u16 pack_into() const
+    {
+        u16 out = 0;
+        out |= (direction & 0xF);
+        out |= (color & 0x1F) << 4;
+        if(bridge)
+        {
+            out |= (bridge_above_direction & 0x3) << (5 + 4);
+            out |= (bridge_above_color & 0x1F) << (2 + 5 + 4);
+        }
+        return out;
+    }
+};
+
+static u8 opposite_direction(u8 dir)
+{
+    return ((dir << 2) | (dir >> 2)) & ALL_DIRS;
+}
+
+struct Level {
+    struct WallInfo {
+        u16 square;
+        u8 blocked_directions;
+    };
+
+    // a square on a path, bridges are crossed once per layer: under (vertical) and above (horizontal)
+    struct PathNode {
+        u16 idx;
+        u8 above;
+        u8 going_to; // direction to the next node, 0 at the end
+    };
+    // where a square layer sits in the paths, color 0 if it isn't on one
+    struct PathSlot {
+        u8 color;
+        u8 segment;
+        u16 pos;
+    };
+    // each source starts a segment, a joined path is held whole in the first one and the second is empty
+    struct ColorPath {
+        std::array<u16, 2> sources;
+        std::array<std::vector<PathNode>, 2> segments;
+        bool joined = false;
+    };
+
+    const u8 width, height, color_count;
+    const bool warp;
+    std::vector<Square> squares;
+
+    // ordered paths of every color, only built while the level is played
+    std::vector<ColorPath> paths;
+    std::vector<PathSlot> slots; // two per square, under then above
+    // paths cut by the current drag, as they were before it
+    struct CutPath {
+        u8 color;
+        ColorPath original;
+    };
+    std::vector<CutPath> cut_paths;
+
+    // squares that look different since the board was last drawn
+    std::vector<u16> dirty_squares;
+    bool dirty_all = false;
+    u32 revision = 0; // changes whenever a square does
+    // squares modified during the current undo step, with their packed value from before the step
+    std::vector<u16> step_squares;
+    std::vector<u16> step_before;
+    std::vector<bool> in_step;
+
+    void mark_dirty(u16 idx)
+    {
+        ++revision;
+        if(dirty_all) return;
+        if(dirty_squares.size() >= squares.size())
+        {
+            dirty_all = true;
+            dirty_squares.clear();
+            return;
+        }
+        dirty_squares.push_back(idx);
+    }
+    // every change to a square during play must go through here
+    Square& modify(u16 idx)
+    {
+        if(in_step.empty())
+            in_step.resize(squares.size());
+        if(!in_step[idx])
+        {
+            in_step[idx] = true;
+            step_squares.push_back(idx);
+            step_before.push_back(squares[idx].pack_into());
+        }
+        mark_dirty(idx);
+        return squares[idx];
+    }
+    void clear_step()
+    {
+        for(auto idx : step_squares)
+            in_step[idx] = false;
+        step_squares.clear();
+        step_before.clear();
+    }
+
+    bool square_is_top_row(u16 idx)
+    {
+        return idx < width;
+    }
+    bool square_is_bottom_row(u16 idx)
+    {
+        return idx >= ((height - 1) * width);
+    }
+    bool square_is_left_column(u16 idx)
+    {
+        return (idx % width) == 0;
+    }
+    bool square_is_right_column(u16 idx)
+    {
+        return (idx % width) == (width - 1);
+    }
+
+    u16 move_idx_up_checked(u16 idx, bool check_walls=true)
+    {
+        if(check_walls && squares[idx].walls & DIR_NORTH)
+            return idx;
+        else if((warp || !check_walls) && square_is_top_row(idx))
+            return squares.size() - (width - idx);
+        else
+            return move_idx_up(idx);
+    }
+    u16 move_idx_down_checked(u16 idx, bool check_walls=true)
+    {
+        if(check_walls && squares[idx].walls & DIR_SOUTH)
+            return idx;
+        else if((warp || !check_walls) && square_is_bottom_row(idx))
+            return idx + width - squares.size();
+        else
+            return move_idx_down(idx);
+    }
+    u16 move_idx_left_checked(u16 idx, bool check_walls=true)
+    {
+        if(check_walls && squares[idx].walls & DIR_WEST)
+            return idx;
+        else if((warp || !check_walls) && square_is_left_column(idx))
+            return idx + width - 1;
+        else
+            return move_idx_left(idx);
+    }
+    u16 move_idx_right_checked(u16 idx, bool check_walls=true)
+    {
+        if(check_walls && squares[idx].walls & DIR_EAST)
+            return idx;
+        else if((warp || !check_walls) && square_is_right_column(idx))
+            return idx - width + 1;
+        else
+            return move_idx_right(idx);
+    }
+
+    Level(DataHolder data) : width(data[4]), height(data[5]), color_count(data[6]), warp(data[7]), squares(width * height)
+    {
+        TRACE_SPAN("Level::Level");
+        const u32 magic = data.read_u32(0);
+        if(memcmp(&magic, "CLFL", 4) != 0)
+            return;
+
+        std::map<u16, u16> sources;
+        std::vector<u16> bridges(data.read_u32(8));
+        std::vector<u16> holes(data.read_u32(12));
+        std::vector<WallInfo> walls(data.read_u32(16));
+
+        std::size_t off = 20;
+        paths.resize(color_count);
+        for(int i = 1; i <= color_count; i++)
+        {
+            paths[i - 1].sources = {data.read_u16(off), data.read_u16(off + 2)};
+            sources.try_emplace(data.read_u16(off), i);
+            sources.try_emplace(data.read_u16(off + 2), i);
+            off += 4;
+        }
+        for(auto& b : bridges)
+        {
+            b = data.read_u16(off);
+            off += 2;
+        }
+        for(auto& h : holes)
+        {
+            h = data.read_u16(off);
+            off += 2;
+        }
+        for(auto& w : walls)
+        {
+            u16 v = data.read_u16(off);
+            w.square = v & 0xFFF;
+            w.blocked_directions = (v & 0xF000) >> 12;
+            off += 2;
+        }
+
+        std::size_t hole_idx = 0;
+        std::size_t bridge_idx = 0;
+        std::size_t wall_idx = 0;
+        std::size_t square_idx = 0;
+        for(auto& square : squares)
+        {
+            memset(&square, 0, sizeof(square));
+
+            if(hole_idx < holes.size() && holes[hole_idx] == square_idx)
+            {
+                square.hole = 1;
+                hole_idx++;
+            }
+            else if(bridge_idx < bridges.size() && bridges[bridge_idx] == square_idx)
+            {
+                square.bridge = 1;
+                bridge_idx++;
+            }
+            else if(auto it = sources.find(square_idx); it != sources.end())
+            {
+                square.source = 1;
+                square.color = it->second;
+            }
+
+            if(wall_idx < walls.size() && walls[wall_idx].square == square_idx)
+            {
+                square.walls = walls[wall_idx].blocked_directions;
+                wall_idx++;
+            }
+
+            square_idx++;
+        }
+    }
+
+    bool completed() const
+    {
+        for(const auto& s : squares)
+        {
+            if(!s.complete()) return false;
+        }
+        return true;
+    }
+    void reset_board()
+    {
+        for(u16 idx = 0; idx < squares.size(); ++idx)
+        {
+            if(squares[idx].is_connected())
+            {
+                auto& s = modify(idx);
+                s.direction = 0;
+                if(!s.is_source())
+                {
+                    s.color = 0;
+                }
+            }
+            if(squares[idx].bridge)
+            {
+                if(squares[idx].bridge_above_direction)
+                {
+                    auto& s = modify(idx);
+                    s.bridge_above_direction = 0;
+                    s.bridge_above_color = 0;
+                }
+            }
+        }
+        rebuild_paths();
+    }
+
+    void remove_direction(u16 idx, u8 direction)
+    {
+        auto& square = modify(idx);
+        if(square.bridge && direction == DIR_EAST)
+        {
+            square.bridge_above_direction &= 1;
+        }
+        else if(square.bridge && direction == DIR_WEST)
+        {
+            square.bridge_above_direction &= 2;
+        }
+        else
+        {
+            square.direction &= ~direction;
+        }
+    }
+    void remove_single_connection(u16 idx, bool bridge_vertical=false) // only use on non-sources with <= 1 connection
+    {
+        const PathNode node = node_at(idx, bridge_vertical);
+        const PathSlot slot = paths_built() ? slot_of(node) : PathSlot{};
+        unlink_single_connection(idx, bridge_vertical);
+        if(!slot.color) return;
+
+        auto& path = paths[slot.color - 1];
+        auto& nodes = path.segments[slot.segment];
+        if(slot.pos != 0 && size_t(slot.pos) + 1 == nodes.size() && !path.joined)
+        {
+            slot_of(node) = {};
+            nodes.pop_back();
+            nodes.back().going_to = 0;
+        }
+        else
+        {
+            rebuild_path(slot.color);
+        }
+    }
+    void unlink_single_connection(u16 idx, bool bridge_vertical)
+    {
+        auto& square = modify(idx);
+        if(square.bridge)
+        {
+            if(!square.is_connected() && square.bridge_above_direction == 0) return;
+            if(bridge_vertical)
+            {
+                if(square.direction & DIR_NORTH)
+                {
+                    remove_direction(move_idx_up_checked(idx), DIR_SOUTH);
+                }
+                else if(square.direction & DIR_SOUTH)
+                {
+                    remove_direction(move_idx_down_checked(idx), DIR_NORTH);
+                }
+                square.color = 0;
+                square.direction = 0;
+            }
+            else
+            {
+                if(square.bridge_above_direction & 2)
+                {
+                    remove_direction(move_idx_right_checked(idx), DIR_WEST);
+                }
+                else if(square.bridge_above_direction & 1)
+                {
+                    remove_direction(move_idx_left_checked(idx), DIR_EAST);
+                }
+                square.bridge_above_color = 0;
+                square.bridge_above_direction = 0;
+            }
+        }
+        else
+        {
+            if(!square.is_connected()) return;
+            if(square.direction & DIR_NORTH)
+            {
+                remove_direction(move_idx_up_checked(idx), DIR_SOUTH);
+            }
+            else if(square.direction & DIR_EAST)
+            {
+                remove_direction(move_idx_right_checked(idx), DIR_WEST);
+            }
+            else if(square.direction & DIR_SOUTH)
+            {
+                remove_direction(move_idx_down_checked(idx), DIR_NORTH);
+            }
+            else if(square.direction & DIR_WEST)
+            {
+                remove_direction(move_idx_left_checked(idx), DIR_EAST);
+            }
+
+            square.direction = 0;
+            if(!square.is_source()) square.color = 0;
+        }
+    }
+
+    bool paths_built() const
+    {
+        return !slots.empty();
+    }
+    void build_paths()
+    {
+        slots.assign(squares.size() * 2, PathSlot{});
+        rebuild_paths();
+    }
+    void release_paths()
+    {
+        std::vector<PathSlot>().swap(slots);
+        cut_paths.clear();
+        for(auto& path : paths)
+        {
+            for(auto& nodes : path.segments)
+                std::vector<PathNode>().swap(nodes);
+            path.joined = false;
+        }
+    }
+    void rebuild_paths()
+    {
+        if(!paths_built()) return;
+        // a square can change color, so every old path goes before any is read back
+        for(u8 color = 1; color <= color_count; ++color)
+            forget_path(color);
+        for(u8 color = 1; color <= color_count; ++color)
+            walk_path(color);
+    }
+    // same for the colors with their bit (color - 1) set, the paths of the others stay as they are
+    void rebuild_paths(u32 colors)
+    {
+        if(!paths_built()) return;
+        for(u8 color = 1; color <= color_count; ++color)
+        {
+            if(colors & (1u << (color - 1)))
+                forget_path(color);
+        }
+        for(u8 color = 1; color <= color_count; ++color)
+        {
+            if(colors & (1u << (color - 1)))
+                walk_path(color);
+        }
+    }
+    // reads a color's path back from the direction bits, linear in its length
+    void rebuild_path(u8 color)
+    {
+        forget_path(color);
+        walk_path(color);
+    }
+
+    PathNode node_at(u16 idx, bool vertical) const
+    {
+        return {idx, u8(squares[idx].bridge && !vertical), 0};
+    }
+    PathSlot& slot_of(const PathNode& n)
+    {
+        return slots[n.idx * 2 + n.above];
+    }
+    u8 node_color(const PathNode& n) const
+    {
+        return n.above ? squares[n.idx].bridge_above_color : squares[n.idx].color;
+    }
+    u8 node_directions(const PathNode& n) const
+    {
+        const auto& s = squares[n.idx];
+        if(n.above)
+            return ((s.bridge_above_direction & 1) ? DIR_WEST : 0) | ((s.bridge_above_direction & 2) ? DIR_EAST : 0);
+        return s.direction;
+    }
+    u16 path_length(u8 color) const
+    {
+        const auto& path = paths[color - 1];
+        u16 length = 0;
+        for(const auto& nodes : path.segments)
+        {
+            if(!nodes.empty())
+                length += nodes.size() - 1;
+        }
+        return length;
+    }
+    bool path_joined(u8 color) const
+    {
+        return paths[color - 1].joined;
+    }
+
+    // links two neighbouring squares, extending the path of that color which ends on from
+    void connect(u16 from, u16 to, u8 going_to, u8 coming_from, u8 color, bool vertical)
+    {
+        modify(to).add_direction_color(coming_from, color);
+        modify(from).add_direction_color(going_to, color);
+        if(!paths_built()) return;
+
+        auto& path = paths[color - 1];
+        const PathNode to_node = node_at(to, vertical);
+        const PathSlot from_slot = slot_of(node_at(from, vertical));
+        const PathSlot to_slot = slot_of(to_node);
+        if(from_slot.color != color || path.joined || size_t(from_slot.pos) + 1 != path.segments[from_slot.segment].size()
+            || (to_slot.color == color && (to_slot.segment == from_slot.segment || size_t(to_slot.pos) + 1 != path.segments[to_slot.segment].size())))
+        {
+            // not growing from the end of a path, nothing the player can do normally
+            rebuild_path(color);
+            return;
+        }
+
+        if(to_slot.color == color)
+        {
+            // reached the end of the other segment, the joined path is read back from the first source
+            rebuild_path(color);
+            return;
+        }
+
+        auto& nodes = path.segments[from_slot.segment];
+        nodes.back().going_to = going_to;
+        nodes.push_back(to_node);
+        slot_of(to_node) = {color, from_slot.segment, u16(nodes.size() - 1)};
+    }
+    // cuts the path going through this square layer right after it, in time linear in what is removed
+    void cut_path_after(PathNode at)
+    {
+        const PathSlot slot = slot_of(at);
+        if(!slot.color) return;
+
+        auto& path = paths[slot.color - 1];
+        auto& nodes = path.segments[slot.segment];
+        const size_t keep = slot.pos + 1;
+        if(keep == nodes.size()) return;
+
+        // a joined path keeps its far source, as the start of the other segment
+        const size_t end = path.joined ? nodes.size() - 1 : nodes.size();
+        for(size_t i = keep; i < end; ++i)
+        {
+            clear_node(nodes[i]);
+            slot_of(nodes[i]) = {};
+        }
+        if(path.joined)
+        {
+            PathNode source = nodes.back();
+            source.going_to = 0;
+            clear_node(source);
+            auto& other = path.segments[slot.segment ^ 1];
+            other.assign(1, source);
+            slot_of(source) = {slot.color, u8(slot.segment ^ 1), 0};
+            path.joined = false;
+        }
+        nodes.resize(keep);
+        remove_direction(at.idx, nodes.back().going_to);
+        nodes.back().going_to = 0;
+    }
+    // frees a square layer held by another color's path by cutting that path just before it
+    // the path is remembered as it was so restore_cut_paths can grow it back until the drag ends
+    void cut_path_at(const PathNode& at)
+    {
+        const PathSlot slot = slot_of(at);
+        if(!slot.color || slot.pos == 0) return;
+
+        const auto& path = paths[slot.color - 1];
+        if(std::none_of(cut_paths.begin(), cut_paths.end(), [&](const CutPath& c) { return c.color == slot.color; }))
+        {
+            cut_paths.push_back({slot.color, path});
+        }
+        cut_path_after(path.segments[slot.segment][slot.pos - 1]);
+    }
+    // grows the cut paths back along their old squares, for as long as these are free again
+    void restore_cut_paths()
+    {
+        for(const auto& cut : cut_paths)
+        {
+            auto& path = paths[cut.color - 1];
+            for(u8 segment = 0; segment < 2; ++segment)
+            {
+                const auto& original = cut.original.segments[segment];
+                auto& nodes = path.segments[segment];
+                while(!path.joined && !nodes.empty() && nodes.size() < original.size())
+                {
+                    const PathNode& prev = original[nodes.size() - 1];
+                    const PathNode& next = original[nodes.size()];
+                    const PathSlot next_slot = slot_of(next);
+                    const bool rejoins = cut.original.joined && nodes.size() + 1 == original.size();
+                    if(next_slot.color != 0 && !rejoins) break;
+
+                    modify(prev.idx).add_direction_color(prev.going_to, cut.color);
+                    modify(next.idx).add_direction_color(opposite_direction(prev.going_to), cut.color);
+                    if(rejoins)
+                    {
+                        rebuild_path(cut.color);
+                        break;
+                    }
+                    nodes.back().going_to = prev.going_to;
+                    nodes.push_back({next.idx, next.above, 0});
+                    slot_of(next) = {cut.color, segment, u16(nodes.size() - 1)};
+                }
+            }
+        }
+    }
+    void clear_node(const PathNode& n)
+    {
+        auto& s = modify(n.idx);
+        if(n.above)
+        {
+            s.bridge_above_direction = 0;
+            s.bridge_above_color = 0;
+        }
+        else
+        {
+            s.direction = 0;
+            if(!s.is_source()) s.color = 0;
+        }
+    }
+
+    u16 get_pixel_width() const
+    {
+        return (width + (warp ? 2 : 0)) * 16;
+    }
+    u16 get_pixel_height() const
+    {
+        return (height + (warp ? 2 : 0)) * 16;
+    }
+    void draw_warp_copy(Renderer& r, u16 idx, float wx, float wy, u16 hide_img, Colors& tints, SquareImages& imgs)
+    {
+        squares[idx].draw(r, wx, wy, tints, imgs);
+        r.sprite(hide_img, wx, wy, 0.875f, &tints.background_tint);
+    }
+    // a rectangle of the board in pixels, only the squares showing inside it get drawn
+    struct Area {
+        int x, y, w, h;
+
+        bool has_cell(float px, float py) const
+        {
+            return px + 16.0f > x && px < x + w && py + 16.0f > y && py < y + h;
+        }
+    };
+    Area whole_area() const
+    {
+        return {0, 0, get_pixel_width(), get_pixel_height()};
+    }
+    void draw(Renderer& r, Colors& tints, SquareImages& imgs)
+    {
+        draw_area(r, tints, imgs, whole_area());
+        forget_dirty();
+    }
+    // unlike draw(), keeps the dirty squares so other drawn copies of the board can still be patched
+    // the squares a path goes straight through are drawn as one rectangle per row or column they make up,
+    // so a board costs about one draw per path turn instead of two per square
+    void draw_area(Renderer& r, Colors& tints, SquareImages& imgs, Area area, PathStyle style = PathStyle::Runs)
+    {
+        PROFILE_SCOPE(LevelDraw);
+        const int off = warp ? 16 : 0;
+        const int first_x = std::max(0, (area.x - off) / 16);
+        const int first_y = std::max(0, (area.y - off) / 16);
+        const int last_x = std::min(width - 1, (area.x + area.w - 1 - off) / 16);
+        const int last_y = std::min(height - 1, (area.y + area.h - 1 - off) / 16);
+
+        // straight squares not drawn yet, from start up to the current square
+        struct Run {
+            int start = 0;
+            u8 color = 0;
+        };
+        constexpr u8 horizontal = DIR_EAST | DIR_WEST;
+        constexpr u8 vertical = DIR_NORTH | DIR_SOUTH;
+        Run row_run;
+        std::vector<Run> column_runs(style == PathStyle::Runs ? std::max(0, last_x - first_x + 1) : 0);
+        // line is the row or column of the run, end the first square after it
+        auto end_run = [&](Run& run, u8 axis, int line, int end) {
+            if(!run.color) return;
+            const float along = off + run.start * 16.0f;
+            const float across = off + line * 16.0f;
+            const float length = (end - run.start) * 16.0f;
+            const auto& tint = tints.colors_tints[run.color - 1];
+            if(axis == vertical)
+                Square::draw_band(r, across, along, axis, length, tint);
+            else
+                Square::draw_band(r, along, across, axis, length, tint);
+            run.color = 0;
+        };
+
+        for(int y = first_y; y <= last_y; ++y)
+        {
+            for(int x = first_x; x <= last_x; ++x)
+            {
+                const auto& s = squares[x + y * width];
+                if(style == PathStyle::Runs)
+                {
+                    const u8 axis = s.hole ? 0 : s.straight_axis();
+                    Run& column_run = column_runs[x - first_x];
+                    if(row_run.color && (axis != horizontal || s.color != row_run.color))
+                        end_run(row_run, horizontal, y, x);
+                    if(column_run.color && (axis != vertical || s.color != column_run.color))
+                        end_run(column_run, vertical, x, y);
+                    if(axis == horizontal && !row_run.color)
+                        row_run = {x, s.color};
+                    else if(axis == vertical && !column_run.color)
+                        column_run = {y, s.color};
+                }
+                if(!s.hole)
+                    s.draw(r, off + x * 16.0f, off + y * 16.0f, tints, imgs, style);
+            }
+            end_run(row_run, horizontal, y, last_x + 1);
+        }
+        for(size_t i = 0; i < column_runs.size(); ++i)
+            end_run(column_runs[i], vertical, first_x + i, last_y + 1);
+        if(!warp) return;
+
+        // the copies around the board, of the squares on the opposite side
+        auto copy = [&](u16 idx, u16 shown_idx, float wx, float wy, u16 hide_img) {
+            if(squares[idx].hole || shown_idx == idx || !area.has_cell(wx, wy)) return;
+            draw_warp_copy(r, shown_idx, wx, wy, hide_img, tints, imgs);
+        };
+        for(int x = first_x; x <= last_x; ++x)
+        {
+            const u16 top_idx = x;
+            const u16 bottom_idx = x + (height - 1) * width;
+            copy(top_idx, move_idx_up_checked(top_idx), off + x * 16.0f, 0.0f, imgs.hide_north_img);
+            copy(bottom_idx, move_idx_down_checked(bottom_idx), off + x * 16.0f, off + height * 16.0f, imgs.hide_south_img);
+        }
+        for(int y = first_y; y <= last_y; ++y)
+        {
+            const u16 left_idx = y * width;
+            const u16 right_idx = y * width + width - 1;
+            copy(right_idx, move_idx_right_checked(right_idx), off + width * 16.0f, off + y * 16.0f, imgs.hide_east_img);
+            copy(left_idx, move_idx_left_checked(left_idx), 0.0f, off + y * 16.0f, imgs.hide_west_img);
+        }
+    }
+    void forget_dirty()
+    {
+        dirty_squares.clear();
+        dirty_all = false;
+    }
+    // draws the dirty squares showing inside the area over a board drawn by draw_area()
+    // each cell is erased back to transparent like a fresh target, then the walls of its neighbours
+    // that overhang into it are drawn again
+    void draw_dirty(Renderer& r, Colors& tints, SquareImages& imgs, Area area)
+    {
+        PROFILE_SCOPE(LevelDraw);
+        const float off_x = warp ? 16.0f : 0.0f;
+        const float off_y = warp ? 16.0f : 0.0f;
+        for(const u16 idx : dirty_squares)
+        {
+            if(squares[idx].hole) continue;
+
+            const u16 x = idx % width;
+            const u16 y = idx / width;
+            const float px = off_x + x * 16.0f;
+            const float py = off_y + y * 16.0f;
+            if(area.has_cell(px, py))
+            {
+                r.erase(px, py, 16.0f, 16.0f);
+                squares[idx].draw(r, px, py, tints, imgs);
+
+                auto redraw_walls = [&](int nx, int ny, u8 facing) {
+                    if(nx < 0 || ny < 0 || nx >= width || ny >= height) return;
+                    const auto& n = squares[nx + ny * width];
+                    if(!n.hole && (n.walls & facing))
+                        n.draw_walls(r, off_x + nx * 16.0f, off_y + ny * 16.0f, tints, imgs, facing);
+                };
+                redraw_walls(x, y - 1, DIR_SOUTH);
+                redraw_walls(x + 1, y, DIR_WEST);
+                redraw_walls(x, y + 1, DIR_NORTH);
+                redraw_walls(x - 1, y, DIR_EAST);
+            }
+
+            if(warp)
+            {
+                // the copies drawn outside the board that show this square
+                auto redraw_copy = [&](u16 from_idx, u16 shown_idx, float wx, float wy, u16 hide_img) {
+                    if(squares[from_idx].hole || shown_idx != idx || !area.has_cell(wx, wy)) return;
+                    r.erase(wx, wy, 16.0f, 16.0f);
+                    draw_warp_copy(r, idx, wx, wy, hide_img, tints, imgs);
+                };
+                if(square_is_bottom_row(idx))
+                {
+                    const u16 top_idx = x;
+                    redraw_copy(top_idx, move_idx_up_checked(top_idx), px, 0.0f, imgs.hide_north_img);
+                }
+                if(square_is_top_row(idx))
+                {
+                    const u16 bottom_idx = (height - 1) * width + x;
+                    redraw_copy(bottom_idx, move_idx_down_checked(bottom_idx), px, off_y + height * 16.0f, imgs.hide_south_img);
+                }
+                if(square_is_left_column(idx))
+                {
+                    const u16 right_idx = idx + width - 1;
+                    redraw_copy(right_idx, move_idx_right_checked(right_idx), off_x + width * 16.0f, py, imgs.hide_east_img);
+                }
+                if(square_is_right_column(idx))
+                {
+                    const u16 left_idx = idx - width + 1;
+                    redraw_copy(left_idx, move_idx_left_checked(left_idx), 0.0f, py, imgs.hide_west_img);
+                }
+            }
+        }
+    }
+    void load_save(DataHolder data)
+    {
+        TRACE_SPAN("Level::load_save");
+        std::size_t off = 0;
+        for(auto& square : squares)
+        {
+            if(!square.hole)
+            {
+                square.load_from(data.read_u16(off));
+            }
+            off += 2;
+        }
 
-    u16 move_idx_up_checked(u16 idx, bool check_walls=true)
+        // older versions could leave a source with two connections, only the one walk_segment follows is kept
+        for(u16 idx = 0; idx < squares.size(); ++idx)
+        {
+            auto& square = squares[idx];
+            if(!square.is_source() || square.connection_count() < 2) continue;
+
+            DEBUGPRINT("save branches at source %d, dropping the extra connections\n", idx);
+            const u8 dropped = square.direction & ~(square.direction & -square.direction);
+            square.direction &= ~dropped;
+            for(u8 dir = DIR_NORTH; dir <= DIR_WEST; dir <<= 1)
+            {
+                if(dropped & dir)
+                    drop_saved_branch(idx, dir, square.color);
+            }
+        }
+    }
+
+#ifdef COLORFILLER_FUZZ
+    // the first rule the board or the paths break, nullptr if they all hold
+    const char* broken_invariant()
     {
-        if(check_walls && squares[idx].walls & DIR_NORTH)
-            return idx;
-        else if((warp || !check_walls) && square_is_top_row(idx))
-            return squares.size() - (width - idx);
-        else
-            return move_idx_up(idx);
+        for(u16 idx = 0; idx < squares.size(); ++idx)
+        {
+            const auto& s = squares[idx];
+            Square copy = s;
+            copy.color = 0;
+            copy.direction = 0;
+            copy.bridge_above_color = 0;
+            copy.bridge_above_direction = 0;
+            copy.load_from(s.pack_into());
+            if(copy.color != s.color || copy.direction != s.direction
+                || copy.bridge_above_color != s.bridge_above_color || copy.bridge_above_direction != s.bridge_above_direction)
+                return "pack_into/load_from round trip";
+
+            if(s.hole)
+            {
+                if(s.color || s.direction) return "hole on a path";
+                continue;
+            }
+            if(s.bridge && s.is_source()) return "bridge on a source";
+            if(s.is_source() && (s.color == 0 || s.color > color_count
+                || (paths[s.color - 1].sources[0] != idx && paths[s.color - 1].sources[1] != idx))) return "source of the wrong color";
+
+            for(u8 above = 0; above < (s.bridge ? 2 : 1); ++above)
+            {
+                const PathNode node{idx, above, 0};
+                const u8 color = node_color(node);
+                const u8 dirs = node_directions(node);
+                if(color > color_count) return "color out of range";
+                if(s.bridge && (dirs & (above ? (DIR_NORTH | DIR_SOUTH) : (DIR_EAST | DIR_WEST)))) return "bridge layer going off its axis";
+                if(number_of_bits(dirs) > (s.is_source() ? 1 : 2)) return "too many connections";
+                if(!s.is_source() && (color == 0) != (dirs == 0)) return "color and connections disagree";
+                for(u8 dir = DIR_NORTH; dir <= DIR_WEST; dir <<= 1)
+                {
+                    if(!(dirs & dir)) continue;
+                    if(s.walls & dir) return "connection through a wall";
+                    const u16 next_idx = move_idx_towards(idx, dir);
+                    const auto& next = squares[next_idx];
+                    const PathNode next_node{next_idx, u8(next.bridge && (dir & (DIR_EAST | DIR_WEST))), 0};
+                    if(next_idx == idx || next.hole || !(node_directions(next_node) & opposite_direction(dir))) return "connection not matched by the neighbour";
+                    if(node_color(next_node) != color) return "color changes along a path";
+                }
+                if(paths_built() && color && slot_of(node).color != color) return "colored square off its color's path";
+            }
+        }
+
+        if(!paths_built()) return nullptr;
+        for(u8 color = 1; color <= color_count; ++color)
+        {
+            const auto& path = paths[color - 1];
+            for(u8 segment = 0; segment < 2; ++segment)
+            {
+                const auto& nodes = path.segments[segment];
+                if(path.joined && segment == 1)
+                {
+                    if(!nodes.empty()) return "joined path with a second segment";
+                    continue;
+                }
+                if(nodes.empty() || nodes.front().idx != path.sources[segment] || nodes.front().above) return "path segment not starting at its source";
+                for(size_t pos = 0; pos < nodes.size(); ++pos)
+                {
+                    const auto& n = nodes[pos];
+                    const auto& slot = slot_of(n);
+                    if(slot.color != color || slot.segment != segment || slot.pos != pos) return "path node and slot disagree";
+                    if(node_color(n) != color) return "path node of another color";
+                    if(pos + 1 == nodes.size())
+                    {
+                        if(n.going_to) return "path end going somewhere";
+                    }
+                    else if(!(node_directions(n) & n.going_to) || move_idx_towards(n.idx, n.going_to) != nodes[pos + 1].idx)
+                    {
+                        return "path nodes not linked";
+                    }
+                }
+                if(path.joined && nodes.back().idx != path.sources[1]) return "joined path not ending at the other source";
+            }
+        }
+        return nullptr;
     }
-    u16 move_idx_down_checked(u16 idx, bool check_walls=true)
+#endif
+private:
+    u16 move_idx_up(u16 idx)
     {
-        if(check_walls && squares[idx].walls & DIR_SOUTH)
-            return idx;
-        else if((warp || !check_walls) && square_is_bottom_row(idx))
-            return idx + width - squares.size();
-        else
-            return move_idx_down(idx);
+        return idx - width;
     }
-    u16 move_idx_left_checked(u16 idx, bool check_walls=true)
+    u16 move_idx_down(u16 idx)
     {
-        if(check_walls && squares[idx].walls & DIR_WEST)
-            return idx;
-        else if((warp || !check_walls) && square_is_left_column(idx))
-            return idx + width - 1;
-        else
-            return move_idx_left(idx);
+        return idx + width;
     }
-    u16 move_idx_right_checked(u16 idx, bool check_walls=true)
+    u16 move_idx_left(u16 idx)
     {
-        if(check_walls && squares[idx].walls & DIR_EAST)
-            return idx;
-        else if((warp || !check_walls) && square_is_right_column(idx))
-            return idx - width + 1;
-        else
-            return move_idx_right(idx);
+        return idx - 1;
     }
-
-    Level(DataHolder data) : width(data[4]), height(data[5]), color_count(data[6]), warp(data[7]), squares(width * height)
+    u16 move_idx_right(u16 idx)
     {
-        const u32 magic = data.read_u32(0);
-        if(memcmp(&magic, "CLFL", 4) != 0)
-            return;
-
-        std::map<u16, u16> sources;
-        std::vector<u16> bridges(data.read_u32(8));
-        std::vector<u16> holes(data.read_u32(12));
-        std::vector<WallInfo> walls(data.read_u32(16));
-
-        std::size_t off = 20;
-        for(int i = 1; i <= color_count; i++)
+        return idx + 1;
+    }
+    // direction bits never point through walls, so following them ignores walls
+    u16 move_idx_towards(u16 idx, u8 dir)
+    {
+        switch(dir)
         {
-            sources.try_emplace(data.read_u16(off), i);
-            sources.try_emplace(data.read_u16(off + 2), i);
-            off += 4;
+            case DIR_NORTH: return move_idx_up_checked(idx, false);
+            case DIR_EAST: return move_idx_right_checked(idx, false);
+            case DIR_SOUTH: return move_idx_down_checked(idx, false);
+            default: return move_idx_left_checked(idx, false);
         }
-        for(auto& b : bridges)
+    }
+
+    void forget_path(u8 color)
+    {
+        auto& path = paths[color - 1];
+        for(auto& nodes : path.segments)
         {
-            b = data.read_u16(off);
-            off += 2;
+            for(const auto& n : nodes)
+            {
+                auto& slot = slot_of(n);
+                if(slot.color == color)
+                    slot = {};
+            }
+            nodes.clear();
         }
-        for(auto& h : holes)
+        path.joined = false;
+    }
+    void walk_path(u8 color)
+    {
+        walk_segment(color, 0);
+        if(!paths[color - 1].joined)
+            walk_segment(color, 1);
+    }
+    // clears what a loaded save has of a color's path from a square onwards in a direction, square by square
+    // a source it reaches only loses that connection
+    void drop_saved_branch(u16 idx, u8 dir, u8 color)
+    {
+        while(true)
         {
-            h = data.read_u16(off);
-            off += 2;
+            const u16 next_idx = move_idx_towards(idx, dir);
+            const PathNode next{next_idx, u8(squares[next_idx].bridge && (dir & (DIR_EAST | DIR_WEST))), 0};
+            const u8 back = opposite_direction(dir);
+            if(next_idx == idx || node_color(next) != color || !(node_directions(next) & back)) return;
+
+            auto& square = squares[next_idx];
+            if(square.is_source())
+            {
+                square.direction &= ~back;
+                return;
+            }
+            const u8 onward = node_directions(next) & ~back;
+            if(next.above)
+            {
+                square.bridge_above_direction = 0;
+                square.bridge_above_color = 0;
+            }
+            else
+            {
+                square.direction = 0;
+                square.color = 0;
+            }
+            if(!onward) return;
+
+            idx = next_idx;
+            dir = onward & -onward;
         }
-        for(auto& w : walls)
+    }
+    void walk_segment(u8 color, u8 segment)
+    {
+        auto& path = paths[color - 1];
+        auto& nodes = path.segments[segment];
+        PathNode node{path.sources[segment], 0, 0};
+        u8 came_from = 0;
+        while(true)
         {
-            u16 v = data.read_u16(off);
-            w.square = v & 0xFFF;
-            w.blocked_directions = (v & 0xF000) >> 12;
-            off += 2;
+            nodes.push_back(node);
+            slot_of(node) = {color, segment, u16(nodes.size() - 1)};
+            if(nodes.size() > 1 && squares[node.idx].is_source())
+            {
+                path.joined = true;
+                return;
+            }
+
+            const u8 dirs = node_directions(node) & ~came_from;
+            if(!dirs) return;
+            const u8 dir = dirs & -dirs;
+            const u16 next_idx = move_idx_towards(node.idx, dir);
+            const PathNode next{next_idx, u8(squares[next_idx].bridge && (dir & (DIR_EAST | DIR_WEST))), 0};
+            if(node_color(next) != color || !(node_directions(next) & opposite_direction(dir)) || slot_of(next).color == color)
+                return;
+
+            nodes.back().going_to = dir;
+            node = next;
+            came_from = opposite_direction(dir);
         }
+    }
+};
+struct LevelPack {
+    const std::size_t start, count;
+    std::vector<Level>& container;
 
-        std::size_t hole_idx = 0;
-        std::size_t bridge_idx = 0;
-        std::size_t wall_idx = 0;
-        std::size_t square_idx = 0;
-        for(auto& square : squares)
+    LevelPack(std::size_t s, std::size_t c, std::vector<Level>& cont) : start(s), count(c), container(cont)
+    {
+        
+    }
+
+    Level& operator[](std::size_t off)
+    {
+        return container[off + start];
+    }
+    std::vector<Level>::iterator begin()
+    {
+        return container.begin() + start;
+    }
+    std::vector<Level>::iterator end()
+    {
+        return begin() + count;
+    }
+};
+
+// Finds the empty squares no unfinished color can fill anymore, and the colors whose ends can't meet
+// The flood fill over empty square layers is spread over frames, step() visits a bounded number of them
+struct BoardAnalysis {
+    static constexpr u32 layers_per_step = 1024;
+
+    const Level* level = nullptr;
+    u32 revision = 0;
+    bool running = false;
+    std::vector<u16> region; // per square layer (square * 2 + above): 0 not reached yet, else region + 1
+    std::vector<u64> region_ends; // per region: bit (color - 1) * 2 + segment for every open end next to it
+    std::vector<u16> stack;
+    size_t scan = 0;
+
+    // results of the last finished analysis
+    std::vector<u16> dead_squares;
+    u32 stranded_colors = 0; // bit color - 1
+
+    static bool layer_free(const Level& l, u16 layer)
+    {
+        const auto& s = l.squares[layer / 2];
+        if(s.hole || s.is_source()) return false;
+        if(layer & 1)
+            return s.bridge && s.bridge_above_direction == 0;
+        return s.direction == 0;
+    }
+    // bit of the open path end on that layer, 0 if there is none
+    static u64 end_bit(const Level& l, u16 layer)
+    {
+        const auto& slot = l.slots[layer];
+        if(!slot.color) return 0;
+        const auto& path = l.paths[slot.color - 1];
+        if(path.joined || size_t(slot.pos) + 1 != path.segments[slot.segment].size()) return 0;
+        return u64(1) << ((slot.color - 1) * 2 + slot.segment);
+    }
+    // calls f with every layer a path on this layer could continue to and the direction of it, walls, warp and bridges included
+    template<typename F>
+    static void for_each_neighbour(Level& l, u16 layer, F&& f)
+    {
+        const u16 idx = layer / 2;
+        const auto& s = l.squares[idx];
+        u8 dirs = ALL_DIRS;
+        if(s.bridge)
+            dirs = (layer & 1) ? (DIR_EAST | DIR_WEST) : (DIR_NORTH | DIR_SOUTH);
+        for(u8 dir = DIR_NORTH; dir <= DIR_WEST; dir <<= 1)
         {
-            memset(&square, 0, sizeof(square));
+            if(!(dirs & dir)) continue;
+            u16 next = idx;
+            switch(dir)
+            {
+                case DIR_NORTH: next = l.move_idx_up_checked(idx); break;
+                case DIR_EAST: next = l.move_idx_right_checked(idx); break;
+                case DIR_SOUTH: next = l.move_idx_down_checked(idx); break;
+                default: next = l.move_idx_left_checked(idx); break;
+            }
+            if(next == idx || l.squares[next].hole) continue;
+            f(u16(next * 2 + (l.squares[next].bridge && (dir & (DIR_EAST | DIR_WEST)))), dir);
+        }
+    }
 
-            if(hole_idx < holes.size() && holes[hole_idx] == square_idx)
+    void step(Level& l)
+    {
+        if(!l.paths_built()) return;
+        if(&l != level || l.revision != revision)
+        {
+            if(&l != level)
             {
-                square.hole = 1;
-                hole_idx++;
+                // the last results index the squares of another level
+                dead_squares.clear();
+                stranded_colors = 0;
             }
-            else if(bridge_idx < bridges.size() && bridges[bridge_idx] == square_idx)
+            level = &l;
+            revision = l.revision;
+            running = true;
+            region.assign(l.squares.size() * 2, 0);
+            region_ends.clear();
+            stack.clear();
+            scan = 0;
+        }
+        if(!running) return;
+
+        PROFILE_SCOPE(Analysis);
+        u32 work = 0;
+        while(work++ < layers_per_step)
+        {
+            if(stack.empty())
             {
-                square.bridge = 1;
-                bridge_idx++;
+                // look for the next region, one layer per unit of work
+                if(scan == region.size())
+                {
+                    finish(l);
+                    return;
+                }
+                const u16 start = scan++;
+                if(region[start] || !layer_free(l, start)) continue;
+
+                region_ends.push_back(0);
+                region[start] = region_ends.size();
+                stack.push_back(start);
             }
-            else if(auto it = sources.find(square_idx); it != sources.end())
+
+            const u16 layer = stack.back();
+            stack.pop_back();
+            const u16 current = region[layer];
+            for_each_neighbour(l, layer, [&](u16 next, u8) {
+                if(layer_free(l, next))
+                {
+                    if(!region[next])
+                    {
+                        region[next] = current;
+                        stack.push_back(next);
+                    }
+                }
+                else
+                {
+                    region_ends[current - 1] |= end_bit(l, next);
+                }
+            });
+        }
+    }
+
+    void finish(Level& l)
+    {
+        running = false;
+
+        // a region can only be filled by a color with both ends next to it
+        dead_squares.clear();
+        for(size_t layer = 0; layer < region.size(); ++layer)
+        {
+            if(!region[layer]) continue;
+            const u64 ends = region_ends[region[layer] - 1];
+            if(ends & (ends >> 1) & 0x5555555555555555ULL) continue;
+            if(dead_squares.empty() || dead_squares.back() != layer / 2)
+                dead_squares.push_back(layer / 2);
+        }
+
+        stranded_colors = 0;
+        for(u8 color = 1; color <= l.color_count; ++color)
+        {
+            const auto& path = l.paths[color - 1];
+            if(path.joined) continue;
+
+            const u64 both = u64(3) << ((color - 1) * 2);
+            bool can_meet = std::any_of(region_ends.begin(), region_ends.end(), [&](u64 ends) { return (ends & both) == both; });
+            if(!can_meet)
             {
-                square.source = 1;
-                square.color = it->second;
+                const auto& end = path.segments[0].back();
+                const u16 other_end = path.segments[1].back().idx * 2 + path.segments[1].back().above;
+                for_each_neighbour(l, end.idx * 2 + end.above, [&](u16 next, u8) {
+                    if(next == other_end) can_meet = true;
+                });
             }
+            if(!can_meet)
+                stranded_colors |= 1 << (color - 1);
+        }
+    }
+};
 
-            if(wall_idx < walls.size() && walls[wall_idx].square == square_idx)
+// Undo/redo log for the level being played, a step is a whole drag or a reset
+// Only the squares a step changed are kept, as their packed value before and after
+// The ring grows when a single step doesn't fit (e.g. resetting a big board), so no step is ever lost
+struct MoveHistory {
+    static constexpr u16 step_start = 0x8000;
+    static constexpr size_t initial_capacity = 1024;
+
+    struct Change {
+        u16 idx; // step_start bit set on the first change of a step
+        u16 before, after;
+    };
+
+    std::vector<Change> changes = std::vector<Change>(initial_capacity);
+    // absolute change counts: the ring holds [first, last), of which [first, applied) is not undone
+    size_t first = 0, applied = 0, last = 0;
+
+    void clear()
+    {
+        first = applied = last = 0;
+    }
+    bool can_undo() const
+    {
+        return applied != first;
+    }
+    bool can_redo() const
+    {
+        return applied != last;
+    }
+    size_t capacity() const
+    {
+        return changes.size();
+    }
+    // makes room for count changes, keeping the ones held in order
+    void grow(size_t count)
+    {
+        size_t size = capacity();
+        while(size < count)
+            size *= 2;
+        std::vector<Change> grown(size);
+        for(size_t i = first; i < last; ++i)
+            grown[i - first] = changes[i % capacity()];
+        last -= first;
+        applied -= first;
+        first = 0;
+        changes = std::move(grown);
+    }
+
+    // false if the step changed nothing and wasn't kept
+    bool push_step(Level& level)
+    {
+        size_t count = 0;
+        for(size_t i = 0; i < level.step_squares.size(); ++i)
+        {
+            if(level.squares[level.step_squares[i]].pack_into() != level.step_before[i])
+                ++count;
+        }
+        if(count != 0)
+        {
+            last = applied; // a new step drops everything that could be redone
+            if(count > capacity())
+                grow(count);
+            while(last + count - first > capacity())
             {
-                square.walls = walls[wall_idx].blocked_directions;
-                wall_idx++;
+                // evict whole steps only
+                do {
+                    ++first;
+                } while(first != last && !(changes[first % capacity()].idx & step_start));
             }
 
-            square_idx++;
+            u16 flag = step_start;
+            for(size_t i = 0; i < level.step_squares.size(); ++i)
+            {
+                const u16 idx = level.step_squares[i];
+                const u16 after = level.squares[idx].pack_into();
+                if(after == level.step_before[i]) continue;
+                changes[last++ % capacity()] = {u16(idx | flag), level.step_before[i], after};
+                flag = 0;
+            }
+            applied = last;
         }
+        level.clear_step();
+        return count != 0;
+    }
+
+    bool undo(Level& level)
+    {
+        if(!can_undo()) return false;
+        // only the paths of the colors the step touched need reading back
+        u32 colors = 0;
+        u16 idx;
+        do {
+            const auto& c = changes[--applied % capacity()];
+            idx = c.idx;
+            level.squares[idx & ~step_start].load_from(c.before);
+            level.mark_dirty(idx & ~step_start);
+            colors |= Square::packed_colors(c.before) | Square::packed_colors(c.after);
+        } while(!(idx & step_start));
+        level.rebuild_paths(colors);
+        return true;
+    }
+    bool redo(Level& level)
+    {
+        if(!can_redo()) return false;
+        u32 colors = 0;
+        do {
+            const auto& c = changes[applied++ % capacity()];
+            level.squares[c.idx & ~step_start].load_from(c.after);
+            level.mark_dirty(c.idx & ~step_start);
+            colors |= Square::packed_colors(c.before) | Square::packed_colors(c.after);
+        } while(applied != last && !(changes[applied % capacity()].idx & step_start));
+        level.rebuild_paths(colors);
+        return true;
+    }
+};
+
+// Fills in the moves the board leaves no choice about, after the player's own moves:
+// a path end with a single square it can continue to, or an empty square with only two
+// ways in where one of them is a path end. Every forced segment is its own undo step.
+struct ForcedMoves {
+    // a count of layers, not a time, so replays and headless runs fill the same squares on the same frame
+    static constexpr u32 layers_per_step = 1024;
+
+    bool running = false;
+    bool changed = false;  // the current pass filled something, so another one is needed
+    size_t scan = 0;
+
+    void start()
+    {
+        running = true;
+        changed = false;
+        scan = 0;
+    }
+    void stop()
+    {
+        running = false;
+    }
+
+    // the only layer the open end on this layer can go to, with the direction to it, false if it has a choice
+    static bool forced_continuation(Level& l, u16 layer, u16& to, u8& dir)
+    {
+        const u8 color = l.slots[layer].color;
+        const auto& path = l.paths[color - 1];
+        const auto& ends = path.segments;
+        const u8 segment = l.slots[layer].segment;
+        const u16 other_end = ends[segment ^ 1].back().idx * 2 + ends[segment ^ 1].back().above;
+        u8 choices = 0;
+        BoardAnalysis::for_each_neighbour(l, layer, [&](u16 next, u8 next_dir) {
+            if(BoardAnalysis::layer_free(l, next) || next == other_end)
+            {
+                ++choices;
+                to = next;
+                dir = next_dir;
+            }
+        });
+        return choices == 1;
     }
-
-    bool completed() const
+    // grows the open end on this layer through the given layer, then as long as it stays forced
+    static void extend(Level& l, u16 layer, u16 to, u8 dir)
     {
-        for(const auto& s : squares)
+        const u8 color = l.slots[layer].color;
+        while(true)
         {
-            if(!s.complete()) return false;
+            l.connect(layer / 2, to / 2, dir, opposite_direction(dir), color, dir & (DIR_NORTH | DIR_SOUTH));
+            if(l.paths[color - 1].joined) return;
+            layer = to;
+            if(!forced_continuation(l, layer, to, dir)) return;
         }
-        return true;
     }
-    void reset_board()
+    // fills what this layer forces, true if anything changed
+    static bool fill_from(Level& l, u16 layer)
     {
-        for(auto& s : squares)
+        u16 to;
+        u8 dir;
+        if(BoardAnalysis::end_bit(l, layer))
         {
-            if(s.is_connected())
+            if(!forced_continuation(l, layer, to, dir)) return false;
+            extend(l, layer, to, dir);
+            return true;
+        }
+        if(!BoardAnalysis::layer_free(l, layer)) return false;
+
+        // every empty square ends up on a path, going through two of its neighbours
+        u8 ways = 0, ends = 0;
+        u16 end = 0;
+        u8 end_dir = 0;
+        BoardAnalysis::for_each_neighbour(l, layer, [&](u16 next, u8 next_dir) {
+            if(BoardAnalysis::layer_free(l, next))
             {
-                s.direction = 0;
-                if(!s.is_source())
-                {
-                    s.color = 0;
-                }
+                ++ways;
             }
-            if(s.bridge)
+            else if(BoardAnalysis::end_bit(l, next))
             {
-                if(s.bridge_above_direction)
-                {
-                    s.bridge_above_direction = 0;
-                    s.bridge_above_color = 0;
-                }
+                ++ways;
+                ++ends;
+                end = next;
+                end_dir = opposite_direction(next_dir);
             }
-        }
+        });
+        if(ways != 2 || ends != 1) return false;
+        extend(l, end, layer, end_dir);
+        return true;
     }
 
-    void remove_direction(u16 idx, u8 direction)
-    {
-        if(squares[idx].bridge && direction == DIR_EAST)
-        {
-            squares[idx].bridge_above_direction &= 1;
-        }
-        else if(squares[idx].bridge && direction == DIR_WEST)
-        {
-            squares[idx].bridge_above_direction &= 2;
-        }
-        else
-        {
-            squares[idx].direction &= ~direction;
-        }
-    }
-    void remove_single_connection(u16 idx, bool bridge_vertical=false) // only use on non-sources with <= 1 connection
+    // true if the board changed
+    bool step(Level& l, MoveHistory& history)
     {
-        auto& square = squares[idx];
-        if(square.bridge)
+        if(!running || !l.paths_built()) return false;
+
+        PROFILE_SCOPE(Assist);
+        TRACE_SPAN("forced moves");
+        bool filled = false;
+        for(u32 work = 0; work < layers_per_step; ++work)
         {
-            if(!square.is_connected() && square.bridge_above_direction == 0) return;
-            if(bridge_vertical)
-            {
-                if(square.direction & DIR_NORTH)
-                {
-                    remove_direction(move_idx_up_checked(idx), DIR_SOUTH);
-                }
-                else if(square.direction & DIR_SOUTH)
-                {
-                    remove_direction(move_idx_down_checked(idx), DIR_NORTH);
-                }
-                square.color = 0;
-                square.direction = 0;
-            }
-            else
+            if(scan == l.squares.size() * 2)
             {
-                if(squares[idx].bridge_above_direction & 2)
+                if(!changed)
                 {
-                    remove_direction(move_idx_right_checked(idx), DIR_WEST);
-                }
-                else if(squares[idx].bridge_above_direction & 1)
-                {
-                    remove_direction(move_idx_left_checked(idx), DIR_EAST);
+                    running = false;
+                    return filled;
                 }
-                square.bridge_above_color = 0;
-                square.bridge_above_direction = 0;
-            }
-        }
-        else
-        {
-            if(!square.is_connected()) return;
-            if(square.direction & DIR_NORTH)
-            {
-                remove_direction(move_idx_up_checked(idx), DIR_SOUTH);
-            }
-            else if(square.direction & DIR_EAST)
-            {
-                remove_direction(move_idx_right_checked(idx), DIR_WEST);
-            }
-            else if(square.direction & DIR_SOUTH)
-            {
-                remove_direction(move_idx_down_checked(idx), DIR_NORTH);
+                scan = 0;
+                changed = false;
             }
-            else if(square.direction & DIR_WEST)
+            if(fill_from(l, scan++))
             {
-                remove_direction(move_idx_left_checked(idx), DIR_EAST);
+                history.push_step(l);
+                changed = filled = true;
             }
-
-            square.direction = 0;
-            if(!square.is_source()) square.color = 0;
         }
+        return filled;
     }
+};
 
-    u16 get_pixel_width() const
-    {
-        return (width + (warp ? 2 : 0)) * 16;
-    }
-    u16 get_pixel_height() const
+// Everything the game logic reads from the outside world in a frame
+struct FrameInput {
+    u32 kDown = 0, kHeld = 0;
+    touchPosition touch{};
+    circlePosition circle{};
+    u64 time = 0;  // milliseconds, same clock as osGetTime
+
+    static FrameInput from_hid()
     {
-        return (height + (warp ? 2 : 0)) * 16;
+        FrameInput in;
+        in.kDown = hidKeysDown();
+        in.kHeld = hidKeysHeld();
+        hidTouchRead(&in.touch);
+        hidCircleRead(&in.circle);
+        in.time = osGetTime();
+        return in;
     }
-    void draw(Colors& tints, SquareImages& imgs)
-    {
-        
-        float off_x = warp ? 16.0f : 0.0f;
-        float off_y = warp ? 16.0f : 0.0f;
-        u8 x = 0;
-        u8 y = 0;
-        for(const auto& s : squares)
-        {
-            if(!s.hole)
-            {
-                const float px = off_x + x * 16.0f;
-                const float py = off_y + y * 16.0f;
-                s.draw(px, py, tints, imgs);
+};
 
-                if(warp)
-                {
-                    const u16 idx = x + y * width;
+// Turns a held direction into presses: one when it goes down, then after a delay one per interval
+struct KeyRepeat {
+    static constexpr u32 max_presses = 2;  // per frame, a late frame catches up a little but the cursor never jumps
 
-                    const u16 up_idx = move_idx_up_checked(idx);
-                    if(square_is_top_row(idx) && up_idx != idx)
-                    {
-                        const float wx = off_x + x * 16.0f;
-                        const float wy = 0.0f;
-                        squares[up_idx].draw(wx, wy, tints, imgs);
-                        C2D_DrawImageAt(imgs.hide_north_img, wx, wy, 0.875f, &tints.background_tint);
-                    }
+    u32 key = 0;
+    u64 next_time = 0;
 
-                    const u16 right_idx = move_idx_right_checked(idx);
-                    if(square_is_right_column(idx) && right_idx != idx)
-                    {
-                        const float wx = off_x + width * 16.0f;
-                        const float wy = off_y + y * 16.0f;
-                        squares[right_idx].draw(wx, wy, tints, imgs);
-                        C2D_DrawImageAt(imgs.hide_east_img, wx, wy, 0.875f, &tints.background_tint);
-                    }
+    u32 update(u32 down, u32 held, u64 now, u32 delay, u32 interval)
+    {
+        if(down)
+        {
+            key = down & -down;
+            next_time = now + delay;
+            return 1;
+        }
+        if(!(held & key))
+        {
+            key = 0;
+            return 0;
+        }
+        if(now < next_time)
+            return 0;
 
-                    const u16 down_idx = move_idx_down_checked(idx);
-                    if(square_is_bottom_row(idx) && down_idx != idx)
-                    {
-                        const float wx = off_x + x * 16.0f;
-                        const float wy = off_y + height * 16.0f;
-                        squares[down_idx].draw(wx, wy, tints, imgs);
-                        C2D_DrawImageAt(imgs.hide_south_img, wx, wy, 0.875f, &tints.background_tint);
-                    }
+        if(interval == 0) interval = 1;
+        u64 presses = 1 + (now - next_time) / interval;
+        next_time += presses * interval;
+        return presses > max_presses ? max_presses : u32(presses);
+    }
+};
 
-                    const u16 left_idx = move_idx_left_checked(idx);
-                    if(square_is_left_column(idx) && left_idx != idx)
-                    {
-                        const float wx = 0.0f;
-                        const float wy = off_y + y * 16.0f;
-                        squares[left_idx].draw(wx, wy, tints, imgs);
-                        C2D_DrawImageAt(imgs.hide_west_img, wx, wy, 0.875f, &tints.background_tint);
+/*
+Replay files: "CFRP", then one byte per frame or run of frames
+- high bit set: the previous frame repeats (low 7 bits + 1) times, with no key pressed down
+- otherwise: flags telling which fields follow, in this order:
+    kDown (u32), kHeld (u32), touch (2 u16), circle (2 s16), 60ths of a second since the previous frame (u16)
+A frame without a flag keeps the previous frame's value (kDown: 0, time: one 60th of a second later)
+Time is kept in whole frames so the 16/17 ms jitter of the clock doesn't cost a field every frame,
+only frames that came late (or early) record it
+*/
+struct Replay {
+    static constexpr char magic[4] = {'C', 'F', 'R', 'P'};
+    enum Fields : u8 {
+        Down = 1,
+        Held = 2,
+        Touch = 4,
+        Circle = 8,
+        Time = 16,
+
+        RunFlag = 0x80,
+    };
+    static constexpr u8 max_run = 0x80;
+};
 
-                    }
-                }
-            }
+struct ReplayRecorder {
+    std::string path;
+    std::vector<u8> data;
+    FrameInput previous;
+    u64 start_time = 0;
+    u64 clock = 0;  // frames the replay will have seen, in 60ths of a second since the first
+    u8 run = 0;
+    bool first = true;
+
+    explicit ReplayRecorder(const std::string& p) : path(p), data(std::begin(Replay::magic), std::end(Replay::magic))
+    {
 
-            ++x;
-            if(x == width)
-            {
-                x = 0;
-                ++y;
-            }
-        }
     }
-    void load_save(DataHolder data)
+    ~ReplayRecorder()
     {
-        std::size_t off = 0;
-        for(auto& square : squares)
+        flush_run();
+        FilePtr fh(fopen(path.c_str(), "wb"));
+        if(!fh)
         {
-            if(!square.hole)
-            {
-                square.load_from(data.read_u16(off));
-            }
-            off += 2;
+            DEBUGPRINT("replay fopen %d\n", errno);
+            return;
         }
+        fwrite(data.data(), 1, data.size(), fh.get());
+        DEBUGPRINT("replay: recorded %zd bytes\n", data.size());
     }
-private:
-    u16 move_idx_up(u16 idx)
+
+    template<typename T>
+    void write(T v)
     {
-        return idx - width;
+        const auto pos = data.size();
+        data.resize(pos + sizeof(T));
+        memcpy(&data[pos], &v, sizeof(T));
     }
-    u16 move_idx_down(u16 idx)
+    void flush_run()
     {
-        return idx + width;
+        if(run)
+        {
+            data.push_back(Replay::RunFlag | (run - 1));
+            run = 0;
+        }
     }
-    u16 move_idx_left(u16 idx)
+
+    void record(const FrameInput& in)
     {
-        return idx - 1;
+        // the frame clock follows the real one to the nearest frame
+        u64 steps = 1;
+        if(first)
+        {
+            start_time = in.time;
+        }
+        else
+        {
+            const u64 target = ((in.time - start_time) * 60 + 500) / 1000;
+            steps = target > clock ? target - clock : 0;
+            clock += steps;
+        }
+
+        u8 flags = 0;
+        if(in.kDown)
+            flags |= Replay::Down;
+        if(first || in.kHeld != previous.kHeld)
+            flags |= Replay::Held;
+        if(first || in.touch.px != previous.touch.px || in.touch.py != previous.touch.py)
+            flags |= Replay::Touch;
+        if(first || in.circle.dx != previous.circle.dx || in.circle.dy != previous.circle.dy)
+            flags |= Replay::Circle;
+        if(!first && steps != 1)
+            flags |= Replay::Time;
+
+        previous = in;
+        first = false;
+
+        if(flags == 0)
+        {
+            if(++run == Replay::max_run)
+                flush_run();
+            return;
+        }
+
+        flush_run();
+        data.push_back(flags);
+        if(flags & Replay::Down)
+            write<u32>(in.kDown);
+        if(flags & Replay::Held)
+            write<u32>(in.kHeld);
+        if(flags & Replay::Touch)
+        {
+            write<u16>(in.touch.px);
+            write<u16>(in.touch.py);
+        }
+        if(flags & Replay::Circle)
+        {
+            write<s16>(in.circle.dx);
+            write<s16>(in.circle.dy);
+        }
+        if(flags & Replay::Time)
+            write<u16>(steps > 0xFFFF ? 0xFFFF : steps);
     }
-    u16 move_idx_right(u16 idx)
+};
+
+struct ReplayPlayer {
+    std::vector<u8> data;
+    size_t off = 0;
+    FrameInput previous;
+    u64 clock = 0;  // in 60ths of a second
+    u8 run = 0;
+    size_t frames = 0;
+    u64 update_ticks = 0;
+
+    explicit ReplayPlayer(const std::string& path)
     {
-        return idx + 1;
+        FilePtr fh(fopen(path.c_str(), "rb"));
+        if(!fh)
+        {
+            DEBUGPRINT("replay fopen %d\n", errno);
+            return;
+        }
+
+        fseek(fh.get(), 0, SEEK_END);
+        data = std::vector<u8>(ftell(fh.get()));
+        fseek(fh.get(), 0, SEEK_SET);
+        fread(data.data(), 1, data.size(), fh.get());
+
+        if(data.size() < sizeof(Replay::magic) || memcmp(data.data(), Replay::magic, sizeof(Replay::magic)) != 0)
+            data.clear();
+        else
+            off = sizeof(Replay::magic);
     }
-};
-struct LevelPack {
-    const std::size_t start, count;
-    std::vector<Level>& container;
 
-    LevelPack(std::size_t s, std::size_t c, std::vector<Level>& cont) : start(s), count(c), container(cont)
+    template<typename T>
+    T read()
     {
-        
+        T v{};
+        if(off + sizeof(T) <= data.size())
+            memcpy(&v, &data[off], sizeof(T));
+        off += sizeof(T);
+        return v;
     }
 
-    Level& operator[](std::size_t off)
+    bool done() const
     {
-        return container[off + start];
+        return run == 0 && off >= data.size();
     }
-    std::vector<Level>::iterator begin()
+
+    // false once the replay is over
+    bool next(FrameInput& out)
     {
-        return container.begin() + start;
+        if(done()) return false;
+
+        FrameInput in = previous;
+        in.kDown = 0;
+        u64 steps = 1;
+        if(run)
+        {
+            run--;
+        }
+        else
+        {
+            const u8 flags = data[off++];
+            if(flags & Replay::RunFlag)
+            {
+                run = flags & ~Replay::RunFlag;
+            }
+            else
+            {
+                if(flags & Replay::Down)
+                    in.kDown = read<u32>();
+                if(flags & Replay::Held)
+                    in.kHeld = read<u32>();
+                if(flags & Replay::Touch)
+                {
+                    in.touch.px = read<u16>();
+                    in.touch.py = read<u16>();
+                }
+                if(flags & Replay::Circle)
+                {
+                    in.circle.dx = read<s16>();
+                    in.circle.dy = read<s16>();
+                }
+                if(flags & Replay::Time)
+                    steps = read<u16>();
+            }
+        }
+        if(frames)
+            clock += steps;
+        in.time = clock * 1000 / 60;
+
+        previous = in;
+        frames++;
+        out = in;
+        return true;
     }
-    std::vector<Level>::iterator end()
+
+    void report() const
     {
-        return begin() + count;
+        if(frames == 0) return;
+        DEBUGPRINT("replay: %zd frames, logic avg %.2f us per frame\n", frames, update_ticks / CPU_TICKS_PER_USEC / frames);
     }
 };
 
@@ -872,7 +2966,7 @@ struct LevelContainer {
     static constexpr int ModeCount = static_cast<int>(Mode::End);
 
     Config& conf;
-    C2D_SpriteSheet sprites;
+    Renderer& renderer;
     C2D_TextBuf textbuf;
     Colors tints;
     SquareImages level_imgs;
@@ -884,9 +2978,12 @@ struct LevelContainer {
     static constexpr size_t px_per_frame_scroll = 4;
     static constexpr int min_packs_for_page = 240/30;
     static constexpr size_t scrollbar_fixed_size = 10;
+    // ring of pack names, pack i is drawn in pack_name_texes[i % size] so scrolling only renders the new ones
     std::array<Tex, min_packs_for_page + 1> pack_name_texes;
+    std::array<size_t, min_packs_for_page + 1> pack_name_tex_packs;  // which pack each holds, SIZE_MAX if none
     size_t selected_pack = 0;
     size_t pack_selection_offset = 0;
+    size_t pack_scroll_page = SIZE_MAX;  // the top pack when a scroll step was last counted, SIZE_MAX before the first
     LevelPack* current_pack = nullptr;
 
     static constexpr Tex3DS_SubTexture info_subtex = {
@@ -898,23 +2995,75 @@ struct LevelContainer {
         0.0f, 1.0f, 1.0f, 0.0f
     };
 
-    std::array<Tex, 2> level_grid_texes;
-    Tex* level_grid_presented = nullptr;
-    Tex* level_grid_hidden = nullptr;
-    size_t selected_level = 0, old_selected_level = SIZE_MAX;
+    // the digits, rendered once side by side, level numbers are put together from them
+    static constexpr float digit_scale = 0.75f;
+    static constexpr int digit_cell_width = 24;
+    Tex digit_atlas;
+    std::array<float, 10> digit_widths{};
+    float digit_height = 0.0f;
+    size_t selected_level = 0;
     int level_selection_offset = 0;
     int level_selection_direction = 0;
     Level* current_level = nullptr;
-    Tex drawn_level_board;
+    // the board being played, in tiles since big levels don't fit a single render target
+    // a 240x240 window never shows more than 4 of them, the spare one keeps a tile of another zoom level around
+    static constexpr u16 board_tile_size = 256;
+    struct BoardTile {
+        Tex tex;
+        int x = -1, y = -1;  // which tile of the board it holds, -1 when none
+        u8 zoom = 0;
+    };
+    std::array<BoardTile, 5> board_tiles;
+    const Level* drawn_board_level = nullptr;  // the level the tiles hold
+    // pixels per square, every zoom level is drawn at its own size instead of shrinking the 16 pixels one
+    static constexpr std::array<u8, 3> zoom_cells{{16, 12, 8}};
+    // level select previews, shrunk to fit the top screen, the least recently shown one gets redrawn first
+    static constexpr u16 preview_size = 256;
+    struct PreviewBoard {
+        Tex board;
+        const Level* level = nullptr;
+        u32 revision = 0;  // the level's revision when drawn, any move since makes the preview stale
+        u32 last_used = 0;
+        float scale_x = 1.0f, scale_y = 1.0f;
+        bool prefetched = false;  // drawn ahead of a selection change and not shown yet
+    };
+    // the previous and next level, the ones above and below, and the page flips
+    using PrefetchTargets = std::array<Level*, 6>;
+    std::vector<PreviewBoard> preview_boards;
+    PreviewBoard* shown_preview = nullptr;
+    u32 preview_clock = 0;
+    // one texel per square thumbnails of the levels in the grid, written straight into the texture
+    // slots are 32x32, the two pages shown while flipping use alternating halves of the atlas
+    static constexpr u16 thumbnail_atlas_size = 256;
+    static constexpr u16 thumbnail_slot_size = 32;
+    static constexpr u8 thumbnail_empty_alpha = 64;
+    static constexpr u8 thumbnail_filled_alpha = 160;
+    Tex thumbnail_atlas;
+    struct ThumbnailSlot {
+        const Level* level = nullptr;
+        u32 revision = 0;
+        u16 width = 0, height = 0;
+    };
+    std::array<ThumbnailSlot, 60> thumbnail_slots;
+    MoveHistory history;
+    BoardAnalysis analysis;
+    ForcedMoves forced_moves;
 
     u16 playing_cursor_idx = 0;
     u16 selected_color = 0;
+    int touch_board_x = -1, touch_board_y = -1; // last touch on the board, -1 if the stylus wasn't on it
+    struct QueuedMove {
+        u16 square;
+        u8 direction; // 0: go to the square if it's a neighbour
+    };
+    std::vector<QueuedMove> queued_moves;
+    KeyRepeat cursor_repeat;
     u16 board_offset_x = 0;
     u16 board_offset_y = 0;
-    u64 y_press_time = 0;
+    std::optional<u64> y_press_time;  // when Y went down, empty once holding it reset the level
     u8 last_move_direction = 0;
     bool level_data_changed = false;
-    bool play_scaled = false;
+    u8 zoom = 0;  // index in zoom_cells
     bool deleted_connection = false;
     bool playing_bridge_above = false;
 
@@ -923,16 +3072,38 @@ struct LevelContainer {
     bool played_any = false;
     bool level_selection_moving = false;
 
-    LevelContainer(Config& c, C2D_SpriteSheet s, C2D_TextBuf t) : conf(c), sprites(s), textbuf(t)
+    // a screen is only drawn again when its commands or the images they show changed
+    u32 top_hash = 0;
+    u32 bottom_hash = 0;
+    bool images_changed = true;  // nothing was drawn on the screens yet
+
+    u64 current_time = 0;
+
+    // headless containers only run the logic, they never create textures nor draw
+    LevelContainer(Config& c, Renderer& r, C2D_TextBuf t, bool headless = false) : conf(c), renderer(r), textbuf(t)
     {
         tints.set(c);
-        level_imgs.set(s);
+        pack_name_tex_packs.fill(SIZE_MAX);
+        if(headless) return;
+
         info_tex.create(512,256);
-        drawn_level_board.create(512, 512);
-        for(auto& t : level_grid_texes)
-            t.create(256,256);
+        for(auto& t : board_tiles)
+            t.tex.create(board_tile_size, board_tile_size);
+        digit_atlas.create(256, 32);
+        thumbnail_atlas.create(thumbnail_atlas_size, thumbnail_atlas_size, false);
+        C3D_TexSetFilter(&thumbnail_atlas.tex, GPU_NEAREST, GPU_NEAREST);
         for(auto& t : pack_name_texes)
             t.create(256,32);
+        // created last, the cache only uses the boards the VRAM left could hold
+        preview_boards = std::vector<PreviewBoard>(std::max<u32>(conf.preview_cache_kb / (preview_size * preview_size * 4 / 1024), 1));
+        for(size_t i = 0; i < preview_boards.size(); ++i)
+        {
+            if(!preview_boards[i].board.create(preview_size, preview_size))
+            {
+                DEBUGPRINT("only %zd of %zd preview boards fit in VRAM\n", i, preview_boards.size());
+                break;
+            }
+        }
     }
 
     size_t pack_count() const
@@ -949,6 +3120,7 @@ struct LevelContainer {
 
     void load_save()
     {
+        TRACE_SPAN("LevelContainer::load_save");
         DEBUGPRINT("load save\n");
         std::vector<u8> zipdata;
         {
@@ -974,6 +3146,7 @@ struct LevelContainer {
         if (r != ARCHIVE_OK)
         {
             DEBUGPRINT("archive_read_open_FILE %d\n", r);
+            archive_read_free(a);
             return;
         }
 
@@ -996,10 +3169,17 @@ struct LevelContainer {
                 }
             }
         }
+
+        r = archive_read_free(a);
+        if (r != ARCHIVE_OK)
+        {
+            DEBUGPRINT("archive_read_free %d\n", r);
+        }
     }
 
     void save()
     {
+        TRACE_SPAN("LevelContainer::save");
         struct archive *a = archive_write_new();
         archive_write_set_format_zip(a);
         archive_write_open_filename(a, conf.save_path.c_str());
@@ -1024,45 +3204,213 @@ struct LevelContainer {
             archive_write_header(a, entry);
             archive_write_data(a, owner.data(), datasize);
 
-            archive_entry_clear(entry);
-        }
-        
-        archive_entry_free(entry);
-        archive_write_close(a);
-        archive_write_free(a);
+            archive_entry_clear(entry);
+        }
+        
+        archive_entry_free(entry);
+        archive_write_close(a);
+        archive_write_free(a);
+    }
+
+    void update_images()
+    {
+        PROFILE_SCOPE(UpdateImages);
+        // first thing these should do, if anything, is clear all the targets the use
+        (this->*(update_images_funcs[static_cast<int>(current_mode)]))();
+    }
+
+    void update(const FrameInput& input)
+    {
+        PROFILE_SCOPE(Update);
+        current_time = input.time;
+        (this->*(update_funcs[static_cast<int>(current_mode)]))(input.kDown, input.kHeld, input.touch, input.circle);
+        if(current_level && selected_color == 0)
+        {
+            // nothing is held anymore, the changes since the last step become one undo step
+            if(end_drag() && conf.fill_forced_moves)
+                forced_moves.start();
+        }
+        if(current_mode == Mode::PlayLevel)
+        {
+            if(selected_color)
+                forced_moves.stop();
+            else if(forced_moves.step(*current_level, history))
+                level_data_changed = true;
+            analysis.step(*current_level);
+        }
+        if(++framectr == 60)
+        {
+            framectr = 0;
+            odd_second = !odd_second;
+        }
+    }
+
+    void draw_top()
+    {
+        PROFILE_SCOPE(DrawTop);
+        (this->*(draw_top_funcs[static_cast<int>(current_mode)]))();
+    }
+    void draw_bottom()
+    {
+        PROFILE_SCOPE(DrawBottom);
+        (this->*(draw_bottom_funcs[static_cast<int>(current_mode)]))();
+    }
+
+    struct ScreenDamage {
+        bool top, bottom;
+    };
+    // hashes what both screens would draw this frame, call after update_images
+    // hasher has to be the renderer the container draws with
+    ScreenDamage damage(DamageRenderer& hasher)
+    {
+        PROFILE_SCOPE(Damage);
+        const int mode = static_cast<int>(current_mode);
+        hasher.start_hash(mode);
+        (this->*(draw_top_funcs[mode]))();
+        const u32 top = hasher.end_hash();
+        hasher.start_hash(mode);
+        (this->*(draw_bottom_funcs[mode]))();
+        const u32 bottom = hasher.end_hash();
+
+        const ScreenDamage out{images_changed || top != top_hash, images_changed || bottom != bottom_hash};
+        top_hash = top;
+        bottom_hash = bottom;
+        images_changed = false;
+        return out;
+    }
+    // the screens were drawn over by someone else, e.g. the home menu
+    void damage_screens()
+    {
+        images_changed = true;
+    }
+    // every draw into one of our textures goes through here, the screens may show it
+    void begin_image(C3D_RenderTarget* target)
+    {
+        images_changed = true;
+        C2D_SceneBegin(target);
+    }
+
+#ifdef COLORFILLER_RASTER
+    Level* shown_level()
+    {
+        if(current_mode == Mode::PlayLevel)
+            return current_level;
+        else if(current_mode == Mode::SelectLevel)
+            return &(*current_pack)[selected_level];
+        return nullptr;
     }
 
-    void update_images()
+    void dump_level_png(const std::vector<C2D_Image>& images)
     {
-        // first thing these should do, if anything, is clear all the targets the use
-        (this->*(update_images_funcs[static_cast<int>(current_mode)]))();
+        Level* level = shown_level();
+        if(!level) return;
+
+        RasterRenderer raster(images, level->get_pixel_width(), level->get_pixel_height());
+        raster.clear(conf.background_color);
+        level->draw(raster, tints, level_imgs);
+
+        char path[64];
+        snprintf(path, sizeof(path), "/3ds/ColorFiller_board_%llu.png", osGetTime());
+        if(raster.write_png(path))
+            DEBUGPRINT("wrote %s\n", path);
     }
 
-    void update()
+    void benchmark_raster(const std::vector<C2D_Image>& images)
     {
-        u32 kDown = hidKeysDown();
-        u32 kHeld = hidKeysHeld();
-        touchPosition touch;
-        hidTouchRead(&touch);
-        circlePosition circle;
-        hidCircleRead(&circle);
-        
-        (this->*(update_funcs[static_cast<int>(current_mode)]))(kDown, kHeld, touch, circle);
-        if(++framectr == 60)
+        Level* level = shown_level();
+        if(!level) return;
+
+        constexpr int frames = 60;
+        RasterRenderer raster(images, level->get_pixel_width(), level->get_pixel_height());
+        const u64 start = svcGetSystemTick();
+        for(int i = 0; i < frames; ++i)
         {
-            framectr = 0;
-            odd_second = !odd_second;
+            raster.clear(conf.background_color);
+            level->draw(raster, tints, level_imgs);
         }
+        const double ms = (svcGetSystemTick() - start) / CPU_TICKS_PER_MSEC;
+        DEBUGPRINT("raster: %d boards of %dx%d in %.1f ms, %.1f boards per second\n", frames, raster.width, raster.height, ms, frames * 1000.0 / ms);
     }
 
-    void draw_top()
+    // draws every board of the pack with the arm sprites and with runs of straight squares, to check they look the same
+    void compare_path_styles(const std::vector<C2D_Image>& images)
     {
-        (this->*(draw_top_funcs[static_cast<int>(current_mode)]))();
+        if(!current_pack) return;
+
+        RecordingRenderer rec;
+        size_t arm_objects = 0, run_objects = 0;
+        size_t pixels = 0, differing = 0;
+        int max_difference = 0;
+        for(auto& level : *current_pack)
+        {
+            const u16 w = level.get_pixel_width();
+            const u16 h = level.get_pixel_height();
+            RasterRenderer arms(images, w, h);
+            RasterRenderer runs(images, w, h);
+            arms.clear(conf.background_color);
+            runs.clear(conf.background_color);
+            level.draw_area(arms, tints, level_imgs, level.whole_area(), PathStyle::Arms);
+            level.draw_area(runs, tints, level_imgs, level.whole_area(), PathStyle::Runs);
+            for(size_t i = 0; i < arms.pixels.size(); i += 4)
+            {
+                int difference = 0;
+                for(size_t c = 0; c < 4; ++c)
+                    difference = std::max(difference, std::abs(arms.pixels[i + c] - runs.pixels[i + c]));
+                if(difference)
+                    differing++;
+                max_difference = std::max(max_difference, difference);
+            }
+            pixels += w * h;
+
+            rec.reset();
+            level.draw_area(rec, tints, level_imgs, level.whole_area(), PathStyle::Arms);
+            arm_objects += rec.object_count;
+            rec.reset();
+            level.draw_area(rec, tints, level_imgs, level.whole_area(), PathStyle::Runs);
+            run_objects += rec.object_count;
+        }
+        DEBUGPRINT("path styles: %zd of %zd pixels differ, by at most %d, objects %zd with arms and %zd with runs\n", differing, pixels, max_difference, arm_objects, run_objects);
     }
-    void draw_bottom()
+#endif
+
+#ifdef COLORFILLER_RENDER_AUDIT
+    // record every board of every pack to find the ones citro2d can't draw in a single frame
+    // returns how many there are
+    size_t audit_draw_calls()
     {
-        (this->*(draw_bottom_funcs[static_cast<int>(current_mode)]))();
+        RecordingRenderer rec;
+        size_t over_limit = 0;
+        for(const auto& name : names)
+        {
+            size_t level_idx = 0;
+            size_t max_objects = 0;
+            u64 total_ticks = 0;
+            auto& pack = positions.at(name);
+            for(auto& level : pack)
+            {
+                rec.reset();
+                const u64 start = svcGetSystemTick();
+                level.draw(rec, tints, level_imgs);
+                total_ticks += svcGetSystemTick() - start;
+
+                if(rec.object_count > max_objects)
+                    max_objects = rec.object_count;
+                if(rec.object_count > C2D_DEFAULT_MAX_OBJECTS)
+                {
+                    DEBUGPRINT("pack '%s' level %zd: %zd objects, over the limit of %d\n", name.c_str(), level_idx + 1, rec.object_count, C2D_DEFAULT_MAX_OBJECTS);
+                    over_limit++;
+                }
+                level_idx++;
+            }
+            if(pack.count)
+                DEBUGPRINT("pack '%s': at most %zd objects per board, %.3f ms per board\n", name.c_str(), max_objects, (total_ticks / CPU_TICKS_PER_MSEC) / pack.count);
+        }
+        return over_limit;
     }
+#endif
+#ifdef COLORFILLER_FUZZ
+    friend size_t run_fuzz(Config& conf);
+#endif
 
 private:
     std::map<std::string, LevelPack> positions;
@@ -1092,9 +3440,6 @@ private:
         {
             current_pack = pack_ptr;
             selected_level = 0;
-            old_selected_level = SIZE_MAX;
-            level_grid_presented = nullptr;
-            level_grid_hidden = nullptr;
             level_selection_offset = 0;
             level_selection_direction = 0;
         }
@@ -1125,17 +3470,28 @@ private:
 
     void selected_level_to_play()
     {
-        auto level_ptr = &((*current_pack)[selected_level]);
+        play_level(&((*current_pack)[selected_level]));
+    }
+    void play_level(Level* level_ptr)
+    {
         current_mode = Mode::PlayLevel;
         if(current_level != level_ptr)
         {
+            if(current_level)
+            {
+                current_level->clear_step();
+                current_level->release_paths();
+            }
+            history.clear();
+            forced_moves.stop();
             current_level = level_ptr;
+            current_level->build_paths();
             playing_cursor_idx = 0;
             selected_color = 0;
             board_offset_x = 0;
             board_offset_y = 0;
             last_move_direction = 0;
-            play_scaled = false;
+            zoom = 0;
             level_data_changed = false;
             deleted_connection = false;
             playing_bridge_above = false;
@@ -1163,6 +3519,8 @@ private:
                         if(s.bridge_above_conn_count() == 1)
                         {
                             selected_color = s.bridge_above_color;
+                            // as if the path had just been drawn onto the bridge, so the drag can't leave it sideways
+                            last_move_direction = (s.bridge_above_direction & 1) ? DIR_EAST : DIR_WEST;
                         }
                     }
                     else
@@ -1170,6 +3528,7 @@ private:
                         if(s.connection_count() == 1)
                         {
                             selected_color = s.color;
+                            last_move_direction = opposite_direction(s.direction);
                         }
                     }
                 }
@@ -1192,11 +3551,34 @@ private:
     {
         DEBUGPRINT("level reset\n");
         current_level->reset_board();
-        y_press_time = 0;
+        y_press_time.reset();
         selected_color = 0;
         level_data_changed = true;
     }
 
+    // the paths cut while dragging stay cut from now on, false if nothing was changed
+    bool end_drag()
+    {
+        current_level->cut_paths.clear();
+        return history.push_step(*current_level);
+    }
+    void undo_move()
+    {
+        selected_color = 0;
+        forced_moves.stop();
+        end_drag();
+        if(history.undo(*current_level))
+            level_data_changed = true;
+    }
+    void redo_move()
+    {
+        selected_color = 0;
+        forced_moves.stop();
+        end_drag();
+        if(history.redo(*current_level))
+            level_data_changed = true;
+    }
+
     void move_playing_cursor(u16 new_idx, u8 dir)
     {
         playing_cursor_idx = new_idx;
@@ -1209,6 +3591,7 @@ private:
 
     void playing_cursor_move_either(u16 new_idx, u8 previous_square_going_to, u8 new_square_coming_from, bool vertical)
     {
+        TRACE_SPAN("playing_cursor_move_either");
         bool completed_with_this_move = false;
 
         auto& current_square = current_level->squares[playing_cursor_idx];
@@ -1231,72 +3614,196 @@ private:
         )
         {
             current_level->remove_single_connection(playing_cursor_idx, vertical);
+            current_level->restore_cut_paths();
             move_playing_cursor(new_idx, previous_square_going_to);
             deleted_connection = true;
             level_data_changed = true;
             return;
         }
 
-        auto& next_square = current_level->squares[new_idx];
-        if(next_square.bridge)
-        {
-            // if we got here, then the bridge only has 0 or 1 connections vertically (under)
-            auto connections = vertical ? next_square.connection_count() : next_square.bridge_above_conn_count();
-            if(connections == 1)
-            {
-                if((vertical ? next_square.color : next_square.bridge_above_color) == selected_color)
-                {
-                    // we connect to it and say we're complete
-                    completed_with_this_move = true;
-                }
-                else
-                {
-                    current_level->remove_single_connection(new_idx, vertical);
-                }
-            }
-            else  // 0
-            {
-                // bottom does it
-            }
-        }
-        else if(next_square.color == selected_color)
+        // bridges are entered on the layer matching the move
+        const auto next_node = current_level->node_at(new_idx, vertical);
+        const u8 next_color = current_level->node_color(next_node);
+        const auto& next_square = current_level->squares[new_idx];
+        if(next_color == selected_color)
         {
-            auto connections = next_square.connection_count();
+            auto connections = number_of_bits(current_level->node_directions(next_node));
             if((connections == 1 && !next_square.is_source()) || (connections == 0 && next_square.is_source()))
             {
                 // we connect to it and say we're complete
                 completed_with_this_move = true;
             }
-            else if(connections == 2)
+            else
             {
-                // can't move, it's complete and breaking it might lead to unfun stuff
+                // can't move, it's complete and breaking it might lead to unfun stuff,
+                // or it's a source already on a path and the path would branch
                 return;
             }
         }
-        else if(!next_square.is_source()) // not my color
+        else if(next_square.is_source())
         {
-            auto connections = next_square.connection_count();
-            if(connections <= 1)
+            return;
+        }
+        else if(next_color != 0)
+        {
+            // another color goes through here, its path is cut for as long as this drag needs the square
+            current_level->cut_path_at(next_node);
+        }
+
+        current_level->connect(playing_cursor_idx, new_idx, previous_square_going_to, new_square_coming_from, selected_color, vertical);
+        move_playing_cursor(new_idx, previous_square_going_to);
+        level_data_changed = true;
+        if(completed_with_this_move) selected_color = 0;
+    }
+
+    void playing_cursor_to_neighbour(u16 new_idx)
+    {
+        if(current_level->move_idx_up_checked(playing_cursor_idx) == new_idx)
+        {
+            playing_cursor_up();
+        }
+        else if(current_level->move_idx_right_checked(playing_cursor_idx) == new_idx)
+        {
+            playing_cursor_right();
+        }
+        else if(current_level->move_idx_down_checked(playing_cursor_idx) == new_idx)
+        {
+            playing_cursor_down();
+        }
+        else if(current_level->move_idx_left_checked(playing_cursor_idx) == new_idx)
+        {
+            playing_cursor_left();
+        }
+    }
+
+    // where a touch lands on the board, in 16 pixels per square board pixels whatever the zoom, false if it's outside the visible part
+    bool touch_to_board(touchPosition touch, int& board_x, int& board_y) const
+    {
+        const Level::Area window = board_window();
+        const int off_x = (320 - window.w)/2;
+        const int off_y = (240 - window.h)/2;
+
+        const int x = touch.px - off_x;
+        const int y = touch.py - off_y;
+        if(x >= 0 && x < window.w && y >= 0 && y < window.h)
+        {
+            board_x = (x + window.x) * 16 / zoom_cells[zoom];
+            board_y = (y + window.y) * 16 / zoom_cells[zoom];
+            return true;
+        }
+        return false;
+    }
+    // the square drawn at a board texture position, the warp border shows the squares on the opposite side
+    bool board_to_square(int board_x, int board_y, u16& idx) const
+    {
+        int square_x = board_x/16;
+        int square_y = board_y/16;
+        if(current_level->warp)
+        {
+            square_x -= 1;
+            square_y -= 1;
+            const bool outside_x = square_x < 0 || square_x >= current_level->width;
+            const bool outside_y = square_y < 0 || square_y >= current_level->height;
+            if(outside_x && outside_y) return false; // corners show nothing
+            if(square_x == -1) square_x = current_level->width - 1;
+            else if(square_x == current_level->width) square_x = 0;
+            if(square_y == -1) square_y = current_level->height - 1;
+            else if(square_y == current_level->height) square_y = 0;
+        }
+        if(square_x < 0 || square_y < 0 || square_x >= current_level->width || square_y >= current_level->height) return false;
+
+        idx = square_x + square_y * current_level->width;
+        return true;
+    }
+
+    void queue_square_at(int board_x, int board_y)
+    {
+        u16 idx;
+        if(board_to_square(board_x, board_y, idx) && (queued_moves.empty() || queued_moves.back().square != idx))
+            queued_moves.push_back({idx, 0});
+    }
+    // walks the squares crossed by the segment between two board positions, in order, one edge at a time
+    void queue_stroke(int x0, int y0, int x1, int y1)
+    {
+        int cell_x = x0/16, cell_y = y0/16;
+        const int end_x = x1/16, end_y = y1/16;
+        const int step_x = (x1 > x0) - (x1 < x0);
+        const int step_y = (y1 > y0) - (y1 < y0);
+        const float from_x = x0 + 0.5f, from_y = y0 + 0.5f;
+        const float dx = x1 - x0, dy = y1 - y0;
+
+        // how far along the segment the next vertical and horizontal square edges are
+        constexpr float never = 1e9f;
+        float next_x = step_x ? ((cell_x + (step_x > 0)) * 16.0f - from_x) / dx : never;
+        float next_y = step_y ? ((cell_y + (step_y > 0)) * 16.0f - from_y) / dy : never;
+        const float delta_x = step_x ? 16.0f / std::abs(dx) : never;
+        const float delta_y = step_y ? 16.0f / std::abs(dy) : never;
+
+        int steps = std::abs(end_x - cell_x) + std::abs(end_y - cell_y);
+        while(steps--)
+        {
+            if(next_x < next_y)
             {
-                // not our color, but we can remove it
-                current_level->remove_single_connection(new_idx);
+                cell_x += step_x;
+                next_x += delta_x;
             }
             else
             {
-                // can't move, it's complete and breaking it might lead to unfun stuff
-                return;
+                cell_y += step_y;
+                next_y += delta_y;
             }
+            queue_square_at(cell_x * 16, cell_y * 16);
         }
-        else
+    }
+    // plays the moves queued this frame in order, they all end up in the same board redraw
+    void apply_queued_moves()
+    {
+        if(queued_moves.empty()) return;
+
+        PROFILE_SCOPE(MoveBatch);
+        TRACE_SPAN("apply_queued_moves", std::to_string(queued_moves.size()));
+        for(const auto& move : queued_moves)
         {
-            return;
+            if(move.direction)
+                playing_cursor_towards(move.direction);
+            else if(selected_color == 0)
+                playing_cursor_idx = move.square;
+            else if(move.square != playing_cursor_idx)
+                playing_cursor_to_neighbour(move.square);
+        }
+        queued_moves.clear();
+    }
+    void playing_cursor_towards(u8 direction)
+    {
+        switch(direction)
+        {
+            case DIR_NORTH: playing_cursor_up(); break;
+            case DIR_EAST: playing_cursor_right(); break;
+            case DIR_SOUTH: playing_cursor_down(); break;
+            default: playing_cursor_left(); break;
+        }
+    }
+    // the circle pad can't pan while it drives the cursor, so the view follows it instead
+    void keep_cursor_visible()
+    {
+        const u16 cell = zoom_cells[zoom];
+        const u16 offset = current_level->warp ? cell : 0;
+        const u16 cursor_x = offset + (playing_cursor_idx % current_level->width) * cell;
+        const u16 cursor_y = offset + (playing_cursor_idx / current_level->width) * cell;
+        if(zoomed_pixel_width() > 240)
+        {
+            if(cursor_x < board_offset_x)
+                board_offset_x = cursor_x;
+            else if(cursor_x + cell > board_offset_x + 240)
+                board_offset_x = cursor_x + cell - 240;
+        }
+        if(zoomed_pixel_height() > 240)
+        {
+            if(cursor_y < board_offset_y)
+                board_offset_y = cursor_y;
+            else if(cursor_y + cell > board_offset_y + 240)
+                board_offset_y = cursor_y + cell - 240;
         }
-
-        next_square.add_direction_color(new_square_coming_from, selected_color);
-        current_square.add_direction_color(previous_square_going_to, selected_color);
-        move_playing_cursor(new_idx, previous_square_going_to);
-        level_data_changed = true;
-        if(completed_with_this_move) selected_color = 0;
     }
 
     void playing_cursor_horizontal(u16 new_idx, u8 previous_square_going_to, u8 new_square_coming_from)
@@ -1358,7 +3865,7 @@ private:
             C2D_TargetClear(target, Config::transparent_color);
             C2D_TextBufClear(textbuf);
 
-            C2D_SceneBegin(target);
+            begin_image(target);
 
             C2D_Text txt1, txt2;
             C2D_TextParse(&txt1, textbuf, "No levels file found.");
@@ -1370,8 +3877,8 @@ private:
             float w2, h2;
             C2D_TextGetDimensions(&txt2, 1.0f, 1.0f, &w2, &h2);
             const float y = (240.0f - (h1 + 2.0f + h2))/2.0f;
-            C2D_DrawText(&txt1, C2D_WithColor, (512.0f - w1)/2.0f, y, 0.5f, 1.0f, 1.0f, Config::full_color);
-            C2D_DrawText(&txt2, C2D_WithColor, (512.0f - w2)/2.0f, y + h1 + 2.0f, 0.5f, 1.0f, 1.0f, Config::full_color);
+            renderer.text(txt1, (512.0f - w1)/2.0f, y, 0.5f, 1.0f, 1.0f, Config::full_color);
+            renderer.text(txt2, (512.0f - w2)/2.0f, y + h1 + 2.0f, 0.5f, 1.0f, 1.0f, Config::full_color);
 
             info_tex.drawn = true;
         }
@@ -1385,7 +3892,7 @@ private:
             C2D_TargetClear(target, Config::transparent_color);
             C2D_TextBufClear(textbuf);
 
-            C2D_SceneBegin(target);
+            begin_image(target);
 
             C2D_Text txt1, txt2;
 
@@ -1398,60 +3905,53 @@ private:
             float w2, h2;
             C2D_TextGetDimensions(&txt2, 1.0f, 1.0f, &w2, &h2);
             const float y = (240.0f - (h1 + 2.0f + h2))/2.0f;
-            C2D_DrawText(&txt1, C2D_WithColor, (512.0f - w1)/2.0f, y, 0.5f, 1.0f, 1.0f, Config::full_color);
-            C2D_DrawText(&txt2, C2D_WithColor, (512.0f - w2)/2.0f, y + h1 + 2.0f, 0.5f, 1.0f, 1.0f, Config::full_color);
+            renderer.text(txt1, (512.0f - w1)/2.0f, y, 0.5f, 1.0f, 1.0f, Config::full_color);
+            renderer.text(txt2, (512.0f - w2)/2.0f, y + h1 + 2.0f, 0.5f, 1.0f, 1.0f, Config::full_color);
+
+            info_tex.drawn = true;
         }
     }
     void update_images_select_pack()
     {
-        static size_t old_idx = SIZE_MAX;
-        size_t cur_idx = pack_selection_offset/30;
+        const size_t cur_idx = pack_selection_offset/30;
+        const size_t end_idx = std::min(cur_idx + pack_name_texes.size(), pack_count());
+        if(pack_scroll_page != cur_idx)
+        {
+            pack_scroll_page = cur_idx;
+            PROFILE_COUNT(PackScrollSteps);
+        }
 
         C2D_TextBufClear(textbuf);
-        if(old_idx != cur_idx)
+        for(size_t i = cur_idx; i < end_idx; ++i)
         {
-            size_t i = cur_idx;
-            for(auto& t : pack_name_texes)
-            {
-                if(i >= pack_count()) break;
-
-                auto target = t.target.get();
-                C2D_TargetClear(target, Config::transparent_color);
-
-                i++;
-            }
-
-            if(!info_tex.drawn)
-            {
-                auto target = info_tex.target.get();
-                C2D_TargetClear(target, Config::transparent_color);
-            }
+            if(pack_name_tex_packs[i % pack_name_texes.size()] != i)
+                C2D_TargetClear(pack_name_texes[i % pack_name_texes.size()].target.get(), Config::transparent_color);
         }
-
-        if(old_idx != cur_idx)
+        if(!info_tex.drawn)
         {
-            old_idx = cur_idx;
-            for(auto& t : pack_name_texes)
-            {
-                if(cur_idx >= pack_count()) break;
-
-                auto target = t.target.get();
+            auto target = info_tex.target.get();
+            C2D_TargetClear(target, Config::transparent_color);
+        }
 
-                C2D_SceneBegin(target);
-                C2D_Text txt;
-                std::string* name = &names[cur_idx];
-                if(auto it = conf.names.find(*name); it != conf.names.end())
-                    name = &it->second;
+        for(size_t i = cur_idx; i < end_idx; ++i)
+        {
+            auto& held = pack_name_tex_packs[i % pack_name_texes.size()];
+            if(held == i) continue;
 
-                C2D_TextParse(&txt, textbuf, name->c_str());
-                C2D_TextOptimize(&txt);
-                float w, h;
-                C2D_TextGetDimensions(&txt, 1.0f, 1.0f, &w, &h);
-                const float y = (32.0f - h)/2.0f;
-                C2D_DrawText(&txt, C2D_WithColor, (256.0f - w)/2.0f, y, 0.5f, 1.0f, 1.0f, Config::full_color);
+            held = i;
+            PROFILE_COUNT(PackNameRenders);
+            begin_image(pack_name_texes[i % pack_name_texes.size()].target.get());
+            C2D_Text txt;
+            std::string* name = &names[i];
+            if(auto it = conf.names.find(*name); it != conf.names.end())
+                name = &it->second;
 
-                cur_idx++;
-            }
+            C2D_TextParse(&txt, textbuf, name->c_str());
+            C2D_TextOptimize(&txt);
+            float w, h;
+            C2D_TextGetDimensions(&txt, 1.0f, 1.0f, &w, &h);
+            const float y = (32.0f - h)/2.0f;
+            renderer.text(txt, (256.0f - w)/2.0f, y, 0.5f, 1.0f, 1.0f, Config::full_color);
         }
 
         static constexpr float txt_scale = 0.875f;
@@ -1459,7 +3959,7 @@ private:
         {
             auto target = info_tex.target.get();
 
-            C2D_SceneBegin(target);
+            begin_image(target);
             C2D_Text txt1, txt2, txt3;
 
             C2D_TextParse(&txt1, textbuf, "Welcome to ColorFiller!");
@@ -1475,103 +3975,340 @@ private:
             float w3, h3;
             C2D_TextGetDimensions(&txt3, txt_scale, txt_scale, &w3, &h3);
             const float y = (240.0f - (h1 + 2.0f + h2 + 2.0f + h3))/2.0f;
-            C2D_DrawText(&txt1, C2D_WithColor, (512.0f - w1)/2.0f, y, 0.5f, txt_scale, txt_scale, Config::full_color);
-            C2D_DrawText(&txt2, C2D_WithColor, (512.0f - w2)/2.0f, y + h1 + 2.0f, 0.5f, txt_scale, txt_scale, Config::full_color);
-            C2D_DrawText(&txt3, C2D_WithColor, (512.0f - w3)/2.0f, y + h1 + 2.0f + h2 + 2.0f, 0.5f, txt_scale, txt_scale, Config::full_color);
+            renderer.text(txt1, (512.0f - w1)/2.0f, y, 0.5f, txt_scale, txt_scale, Config::full_color);
+            renderer.text(txt2, (512.0f - w2)/2.0f, y + h1 + 2.0f, 0.5f, txt_scale, txt_scale, Config::full_color);
+            renderer.text(txt3, (512.0f - w3)/2.0f, y + h1 + 2.0f + h2 + 2.0f, 0.5f, txt_scale, txt_scale, Config::full_color);
+
+            info_tex.drawn = true;
         }
     }
     void update_images_select_level()
     {
-        C2D_TextBufClear(textbuf);
-
-        if(old_selected_level != selected_level)
+        if(!digit_atlas.drawn)
         {
-            auto target = drawn_level_board.target.get();
+            auto target = digit_atlas.target.get();
             C2D_TargetClear(target, Config::transparent_color);
         }
-
-        if(level_grid_presented == nullptr)
+        const bool atlas_needed = !digit_atlas.drawn;
+        const Level& l = (*current_pack)[selected_level];
+        PreviewBoard* redraw = nullptr;
+        if(!preview_fresh(shown_preview, &l))
         {
-            level_grid_presented = &level_grid_texes[0];
-            auto target = level_grid_presented->target.get();
-
-            C2D_TargetClear(target, Config::transparent_color);
-
-            C2D_SceneBegin(target);
-
-            C2D_Text txt;
-            float w, h;
-            constexpr float txt_scale = 0.75f;
-            char msg[12] = {0};
-            ldiv_t d = ldiv(selected_level, 5 * 6);
-            for(int y = 0; y < 6; ++y)
+            shown_preview = cached_preview(&l);
+            if(shown_preview)
             {
-                for(int x = 0; x < 5; ++x)
-                {
-                    int idx = y * 5 + x + d.quot * 5 * 6;
-                    if(size_t(idx) >= current_pack->count) return;
-
-                    snprintf(msg, sizeof(msg), "%d", idx + 1);
-                    C2D_TextParse(&txt, textbuf, msg);
-                    C2D_TextGetDimensions(&txt, txt_scale, txt_scale, &w, &h);
-                    C2D_DrawText(&txt, C2D_WithColor, 3.0f + x * 50.0f + (50.0f - w)/2.0f, y * 40.0f + (40.0f - h)/2.0f, 0.5f, txt_scale, txt_scale, Config::full_color);
-                }
+                PROFILE_COUNT(PreviewHits);
+                if(shown_preview->prefetched)
+                    PROFILE_COUNT(PrefetchHits);
+            }
+            else
+            {
+                PROFILE_COUNT(PreviewMisses);
+                PROFILE_COUNT(PrefetchMisses);
+                shown_preview = redraw = least_recent_preview();
+                if(redraw)
+                    C2D_TargetClear(redraw->board.target.get(), Config::transparent_color);
+            }
+            if(shown_preview)
+            {
+                shown_preview->prefetched = false;
+                shown_preview->last_used = ++preview_clock;
             }
         }
-        else if(level_selection_moving)
+        else if(!atlas_needed && !level_selection_moving)
         {
-            if(level_grid_presented == &level_grid_texes[0])
-                level_grid_hidden = &level_grid_texes[1];
-            else
-                level_grid_hidden = &level_grid_texes[0];
-            auto target = level_grid_hidden->target.get();
+            prefetch_preview();
+        }
 
-            C2D_TargetClear(target, Config::transparent_color);
+        {
+            PROFILE_SCOPE(Thumbnails);
+            const size_t quot = selected_level / 30;
+            bool written = write_thumbnails(quot);
+            if(level_selection_direction != 0)
+                written |= write_thumbnails(quot + ((level_selection_direction > 0) ? 1 : -1));
+            if(written)
+            {
+                C3D_TexFlush(&thumbnail_atlas.tex);
+                images_changed = true;
+            }
+        }
 
-            C2D_SceneBegin(target);
+        if(!digit_atlas.drawn)
+        {
+            digit_atlas.drawn = true;
+            C2D_TextBufClear(textbuf);
+            begin_image(digit_atlas.target.get());
 
             C2D_Text txt;
-            float w, h;
-            constexpr float txt_scale = 0.75f;
-            char msg[12] = {0};
-            ldiv_t d = ldiv(selected_level, 5 * 6);
-            for(int y = 0; y < 6; ++y)
+            const char digits[] = "0123456789";
+            for(int i = 0; i < 10; ++i)
             {
-                for(int x = 0; x < 5; ++x)
-                {
-                    int idx = y * 5 + x + d.quot * 5 * 6;
-                    if(size_t(idx) >= current_pack->count) return;
+                C2D_TextParse(&txt, textbuf, std::string(1, digits[i]).c_str());
+                C2D_TextGetDimensions(&txt, digit_scale, digit_scale, &digit_widths[i], &digit_height);
+                renderer.text(txt, float(i * digit_cell_width), 0.0f, 0.5f, digit_scale, digit_scale, Config::full_color);
+            }
+        }
 
-                    snprintf(msg, sizeof(msg), "%d", idx + 1);
-                    C2D_TextParse(&txt, textbuf, msg);
-                    C2D_TextGetDimensions(&txt, txt_scale, txt_scale, &w, &h);
-                    C2D_DrawText(&txt, C2D_WithColor, 3.0f + x * 50.0f + (50.0f - w)/2.0f, y * 40.0f + (40.0f - h)/2.0f, 0.5f, txt_scale, txt_scale, Config::full_color);
+        if(redraw)
+        {
+            TRACE_SPAN("redraw preview board");
+            draw_preview(*redraw, (*current_pack)[selected_level]);
+        }
+    }
+    static size_t thumbnail_slot_of(size_t level_idx)
+    {
+        return (level_idx / 30 % 2) * 30 + level_idx % 30;
+    }
+    // rewrites the thumbnails of a page whose levels changed since, returns whether any was
+    bool write_thumbnails(size_t quot)
+    {
+        bool written = false;
+        for(size_t i = 0; i < 30 && quot * 30 + i < current_pack->count; ++i)
+        {
+            const size_t level_idx = quot * 30 + i;
+            const Level& l = (*current_pack)[level_idx];
+            ThumbnailSlot& slot = thumbnail_slots[thumbnail_slot_of(level_idx)];
+            if(slot.level == &l && slot.revision == l.revision) continue;
+
+            slot.level = &l;
+            slot.revision = l.revision;
+            // boards bigger than a slot are shrunk by a whole number of squares per texel, the same on both axes
+            const u16 step = (std::max(l.width, l.height) + thumbnail_slot_size - 1) / thumbnail_slot_size;
+            slot.width = (l.width + step - 1) / step;
+            slot.height = (l.height + step - 1) / step;
+
+            const u32 origin_x = (thumbnail_slot_of(level_idx) % 8) * thumbnail_slot_size;
+            const u32 origin_y = (thumbnail_slot_of(level_idx) / 8) * thumbnail_slot_size;
+            u32* texels = static_cast<u32*>(thumbnail_atlas.tex.data);
+            for(u32 y = 0; y < thumbnail_slot_size; ++y)
+            {
+                // texture rows are stored bottom up
+                const u32 ty = thumbnail_atlas_size - 1 - (origin_y + y);
+                for(u32 x = 0; x < thumbnail_slot_size; ++x)
+                {
+                    u32 texel = 0;
+                    if(x < slot.width && y < slot.height)
+                        texel = thumbnail_texel(l, x * step, y * step, step);
+                    texels[texel_offset(origin_x + x, ty, thumbnail_atlas_size)] = texel;
                 }
             }
+            written = true;
+        }
+        return written;
+    }
+    // what most squares of a step by step block show: a hole, an empty square or a color
+    u32 thumbnail_texel(const Level& l, u16 block_x, u16 block_y, u16 step) const
+    {
+        std::array<u8, 2 + std::tuple_size<decltype(conf.colors)>::value> votes{};  // holes, empty squares, then each color
+        const u16 end_x = std::min<u16>(block_x + step, l.width);
+        const u16 end_y = std::min<u16>(block_y + step, l.height);
+        for(u16 y = block_y; y < end_y; ++y)
+        {
+            for(u16 x = block_x; x < end_x; ++x)
+            {
+                const Square& sq = l.squares[x + y * l.width];
+                const u8 color = sq.color ? sq.color : sq.bridge_above_color;
+                ++votes[sq.hole ? 0 : 1 + color];
+            }
         }
 
-        if(old_selected_level != selected_level)
+        const size_t most = std::max_element(votes.begin(), votes.end()) - votes.begin();
+        if(most == 0)
+            return 0;
+        if(most == 1)
+            return color_to_texel(conf.interface_color, thumbnail_empty_alpha);
+        return color_to_texel(conf.colors[most - 2], thumbnail_filled_alpha);
+    }
+    static bool preview_fresh(const PreviewBoard* p, const Level* l)
+    {
+        return p && p->level == l && p->revision == l->revision;
+    }
+    PreviewBoard* cached_preview(const Level* l)
+    {
+        for(auto& p : preview_boards)
         {
-            old_selected_level = selected_level;
-            auto target = drawn_level_board.target.get();
-            
-            C2D_SceneBegin(target);
-            
-            auto& l = (*current_pack)[selected_level];
-            l.draw(tints, level_imgs);
+            if(preview_fresh(&p, l))
+                return &p;
+        }
+        return nullptr;
+    }
+    // the preview to draw over, never the one on screen nor one holding a level in keep
+    PreviewBoard* least_recent_preview(const PrefetchTargets& keep = {})
+    {
+        PreviewBoard* out = nullptr;
+        for(auto& p : preview_boards)
+        {
+            if(!p.board.inited || &p == shown_preview) continue;
+            if(std::any_of(keep.begin(), keep.end(), [&](Level* l) { return l && preview_fresh(&p, l); })) continue;
+            if(!out || p.last_used < out->last_used)
+                out = &p;
+        }
+        return out;
+    }
+    // the preview's target must have been cleared already
+    void draw_preview(PreviewBoard& p, Level& l)
+    {
+        const u16 w = l.get_pixel_width();
+        const u16 h = l.get_pixel_height();
+        p.scale_x = (w > 240) ? 240.0f/w : 1.0f;
+        p.scale_y = (h > 240) ? 240.0f/h : 1.0f;
+        p.level = &l;
+        p.revision = l.revision;
+
+        begin_image(p.board.target.get());
+        ScaledRenderer scaled(renderer, p.scale_x, p.scale_y);
+        l.draw_area(scaled, tints, level_imgs, l.whole_area());
+    }
+    // the levels the next selection most likely is, most likely first: the neighbours, then the page flips
+    PrefetchTargets prefetch_targets() const
+    {
+        PrefetchTargets targets{};
+        const size_t count = current_pack->count;
+        if(selected_level + 1 < count)
+            targets[0] = &(*current_pack)[selected_level + 1];
+        if(selected_level >= 1)
+            targets[1] = &(*current_pack)[selected_level - 1];
+        if(selected_level + 5 < count)
+            targets[2] = &(*current_pack)[selected_level + 5];
+        if(selected_level >= 5)
+            targets[3] = &(*current_pack)[selected_level - 5];
+        // select_level_next_page stops on the last level of a partial page
+        if((selected_level / 30 + 1) * 30 < count)
+            targets[4] = &(*current_pack)[std::min(selected_level + 30, count - 1)];
+        if(selected_level >= 30)
+            targets[5] = &(*current_pack)[selected_level - 30];
+        return targets;
+    }
+    // draws at most one of the likely next previews, over a preview no likelier one is using
+    void prefetch_preview()
+    {
+        const PrefetchTargets targets = prefetch_targets();
+        for(size_t i = 0; i < targets.size(); ++i)
+        {
+            Level* l = targets[i];
+            if(!l || cached_preview(l)) continue;
+
+            PrefetchTargets likelier = targets;
+            std::fill(likelier.begin() + i, likelier.end(), nullptr);
+            PreviewBoard* spare = least_recent_preview(likelier);
+            if(!spare) return;
+
+            TRACE_SPAN("prefetch preview board");
+            C2D_TargetClear(spare->board.target.get(), Config::transparent_color);
+            draw_preview(*spare, *l);
+            spare->prefetched = true;
+            spare->last_used = ++preview_clock;
+            return;
         }
     }
+    // the board's size at the current zoom level
+    u16 zoomed_pixel_width() const
+    {
+        return current_level->get_pixel_width() / 16 * zoom_cells[zoom];
+    }
+    u16 zoomed_pixel_height() const
+    {
+        return current_level->get_pixel_height() / 16 * zoom_cells[zoom];
+    }
+    u16 max_board_offset_x() const
+    {
+        return std::max(zoomed_pixel_width() - 240, 0);
+    }
+    u16 max_board_offset_y() const
+    {
+        return std::max(zoomed_pixel_height() - 240, 0);
+    }
+    // the next zoom level while the board doesn't fit the screen yet, then back to the closest one
+    void cycle_zoom()
+    {
+        const u16 old_cell = zoom_cells[zoom];
+        if(zoom + 1 < int(zoom_cells.size()) && (zoomed_pixel_width() > 240 || zoomed_pixel_height() > 240))
+            ++zoom;
+        else
+            zoom = 0;
+
+        // keep the middle of the window on the same spot of the board
+        const u16 cell = zoom_cells[zoom];
+        board_offset_x = std::clamp((board_offset_x + 120) * cell / old_cell - 120, 0, int(max_board_offset_x()));
+        board_offset_y = std::clamp((board_offset_y + 120) * cell / old_cell - 120, 0, int(max_board_offset_y()));
+    }
+    // the part of the board shown, in pixels at the current zoom level
+    Level::Area board_window() const
+    {
+        return {
+            std::min(board_offset_x, max_board_offset_x()), std::min(board_offset_y, max_board_offset_y()),
+            std::min<int>(zoomed_pixel_width(), 240), std::min<int>(zoomed_pixel_height(), 240),
+        };
+    }
+    // the part of the board a tile shows, in 16 pixels per square board pixels
+    // walls reach a pixel past their square, so the squares right outside a tile get drawn into it too
+    static Level::Area tile_area(const BoardTile& t)
+    {
+        const int cell = zoom_cells[t.zoom];
+        const int first_x = t.x * board_tile_size * 16 / cell;
+        const int first_y = t.y * board_tile_size * 16 / cell;
+        const int last_x = ((t.x + 1) * board_tile_size * 16 + cell - 1) / cell;
+        const int last_y = ((t.y + 1) * board_tile_size * 16 + cell - 1) / cell;
+        return {first_x - 1, first_y - 1, last_x - first_x + 2, last_y - first_y + 2};
+    }
+    ScaledRenderer tile_renderer(const BoardTile& t)
+    {
+        const float scale = zoom_cells[t.zoom] / 16.0f;
+        return ScaledRenderer(renderer, scale, scale, t.x * board_tile_size / scale, t.y * board_tile_size / scale);
+    }
     void update_images_play_level()
     {
+        if(drawn_board_level != current_level || current_level->dirty_all)
+        {
+            drawn_board_level = current_level;
+            for(auto& t : board_tiles)
+                t.x = t.y = -1;
+            current_level->forget_dirty();
+        }
+
         if(level_data_changed)
         {
             played_any = true;
             level_data_changed = false;
-            auto target = drawn_level_board.target.get();
+            TRACE_SPAN("patch board");
+            // every drawn tile gets the changed squares, hidden ones too since they're kept
+            for(const auto& t : board_tiles)
+            {
+                if(t.x < 0) continue;
 
-            C2D_TargetClear(target, Config::transparent_color);
-            C2D_SceneBegin(target);
-            current_level->draw(tints, level_imgs);
+                begin_image(t.tex.target.get());
+                ScaledRenderer r = tile_renderer(t);
+                current_level->draw_dirty(r, tints, level_imgs, tile_area(t));
+            }
+            current_level->forget_dirty();
+        }
+
+        // only the tiles the window shows get drawn, into tiles it doesn't show anymore
+        const Level::Area window = board_window();
+        const int first_x = window.x / board_tile_size, last_x = (window.x + window.w - 1) / board_tile_size;
+        const int first_y = window.y / board_tile_size, last_y = (window.y + window.h - 1) / board_tile_size;
+        auto shown = [&](const BoardTile& t) {
+            return t.zoom == zoom && t.x >= first_x && t.x <= last_x && t.y >= first_y && t.y <= last_y;
+        };
+        for(int tile_y = first_y; tile_y <= last_y; ++tile_y)
+        {
+            for(int tile_x = first_x; tile_x <= last_x; ++tile_x)
+            {
+                if(std::any_of(board_tiles.begin(), board_tiles.end(), [&](const BoardTile& t) { return t.x == tile_x && t.y == tile_y && t.zoom == zoom; })) continue;
+
+                auto spare = std::find_if(board_tiles.begin(), board_tiles.end(), [&](const BoardTile& t) { return t.x < 0; });
+                if(spare == board_tiles.end())
+                    spare = std::find_if(board_tiles.begin(), board_tiles.end(), [&](const BoardTile& t) { return !shown(t); });
+                TRACE_SPAN("redraw board tile");
+                spare->x = tile_x;
+                spare->y = tile_y;
+                spare->zoom = zoom;
+                auto target = spare->tex.target.get();
+                C2D_TargetClear(target, Config::transparent_color);
+                begin_image(target);
+                ScaledRenderer r = tile_renderer(*spare);
+                current_level->draw_area(r, tints, level_imgs, tile_area(*spare));
+            }
         }
     }
 
@@ -1710,7 +4447,6 @@ private:
                 level_selection_offset = 0;
                 level_selection_direction = 0;
                 level_selection_moving = false;
-                std::swap(level_grid_presented, level_grid_hidden);
             }
         }
         else
@@ -1831,6 +4567,15 @@ private:
     }
     void update_play_level(u32 kDown, u32 kHeld, touchPosition touch, circlePosition circle)
     {
+        // the circle pad and the D-pad give the same directions
+        auto to_dpad = [this](u32 keys) -> u32 {
+            if(conf.circle_pad_cursor)
+                keys |= (keys & (KEY_CPAD_RIGHT | KEY_CPAD_LEFT | KEY_CPAD_UP | KEY_CPAD_DOWN)) >> 24;
+            return keys & (KEY_DRIGHT | KEY_DLEFT | KEY_DUP | KEY_DDOWN);
+        };
+        // kept up to date every frame, even the ones another input takes, so it never has a backlog to catch up on
+        const u32 presses = cursor_repeat.update(to_dpad(kDown), to_dpad(kHeld), current_time, conf.key_repeat_delay, conf.key_repeat_interval);
+
         if(kDown & KEY_A) // grab source/loose end/above bridge loose end
         {
             select_square();
@@ -1838,24 +4583,32 @@ private:
         else if(kDown & KEY_Y) // grab source/loose end/under bridge loose end, or reset if held
         {
             playing_bridge_above = !playing_bridge_above;
-            y_press_time = osGetTime();
+            y_press_time = current_time;
         }
         else if(kHeld & KEY_Y) // reset if held long enough
         {
             if(y_press_time)
             {
-                if(osGetTime() >= (y_press_time + (3ULL * 1000)))
+                if(current_time >= (*y_press_time + (3ULL * 1000)))
                 {
                     reset_level();
                 }
             }
         }
+        else if(kDown & KEY_L) // undo the last move or reset
+        {
+            undo_move();
+        }
+        else if(kDown & KEY_R) // redo
+        {
+            redo_move();
+        }
         else if(kDown & KEY_X) // toggle scaling
         {
             auto drawn_w = current_level->get_pixel_width();
             auto drawn_h = current_level->get_pixel_height();
             if(drawn_w > 240 || drawn_h > 240)
-                play_scaled = !play_scaled;
+                cycle_zoom();
         }
         else if(kDown & KEY_TOUCH)
         {
@@ -1864,6 +4617,7 @@ private:
             u16 bottom_y = 240 - 40;
             u16 right_x = 320 - 40;
 
+            touch_board_x = -1;
             if(touch.px >= start && touch.px < end)
             {
                 if(touch.py >= start && touch.py < end)
@@ -1889,57 +4643,32 @@ private:
                     auto drawn_w = current_level->get_pixel_width();
                     auto drawn_h = current_level->get_pixel_height();
                     if(drawn_w > 240 || drawn_h > 240)
-                        play_scaled = !play_scaled;
+                        cycle_zoom();
                 }
                 else if(touch.py >= (bottom_y + start) && touch.py < (bottom_y + end))
                 {
                     playing_bridge_above = !playing_bridge_above;
                 }
             }
-            else if(!play_scaled)
+            else
             {
-                const auto drawn_w = current_level->get_pixel_width();
-                const auto drawn_h = current_level->get_pixel_height();
-                const auto visible_w = drawn_w > 240 ? 240 : drawn_w;
-                const auto visible_h = drawn_h > 240 ? 240 : drawn_h;
-                auto off_x = (320 - 240)/2;
-                auto off_y = 0;
-
-                if(drawn_w <= 240)
-                    off_x = (320 - drawn_w)/2;
-                if(drawn_h <= 240)
-                    off_y = (240 - drawn_h)/2;
-
-                auto x = touch.px - off_x;
-                auto y = touch.py - off_y;
-                if(x >= 0 && x <= visible_w && y >= 0 && y < visible_h)
+                int board_x, board_y;
+                u16 new_idx;
+                if(touch_to_board(touch, board_x, board_y))
                 {
-                    auto square_x = (x + board_offset_x)/16 - (current_level->warp ? 1 : 0);
-                    auto square_y = (y + board_offset_y)/16 - (current_level->warp ? 1 : 0);
-                    if(square_x < 0 || square_y < 0 || square_x >= current_level->width || square_y >= current_level->height) return;
+                    touch_board_x = board_x;
+                    touch_board_y = board_y;
+                    if(!board_to_square(board_x, board_y, new_idx)) return;
 
-                    size_t new_idx = square_x + square_y * current_level->width;
                     if(selected_color)
                     {
                         if(new_idx == playing_cursor_idx)
                         {
                             selected_color = 0;
                         }
-                        else if(current_level->move_idx_up_checked(playing_cursor_idx) == new_idx)
-                        {
-                            playing_cursor_up();
-                        }
-                        else if(current_level->move_idx_right_checked(playing_cursor_idx) == new_idx)
-                        {
-                            playing_cursor_right();
-                        }
-                        else if(current_level->move_idx_down_checked(playing_cursor_idx) == new_idx)
-                        {
-                            playing_cursor_down();
-                        }
-                        else if(current_level->move_idx_left_checked(playing_cursor_idx) == new_idx)
+                        else
                         {
-                            playing_cursor_left();
+                            playing_cursor_to_neighbour(new_idx);
                         }
                     }
                     else
@@ -1958,50 +4687,17 @@ private:
         }
         else if(kHeld & KEY_TOUCH)
         {
-            const auto drawn_w = current_level->get_pixel_width();
-            const auto drawn_h = current_level->get_pixel_height();
-            const auto visible_w = drawn_w > 240 ? 240 : drawn_w;
-            const auto visible_h = drawn_h > 240 ? 240 : drawn_h;
-            auto off_x = (320 - 240)/2;
-            auto off_y = 0;
-
-            if(drawn_w <= 240)
-                off_x = (320 - drawn_w)/2;
-            if(drawn_h <= 240)
-                off_y = (240 - drawn_h)/2;
-
-            auto x = touch.px - off_x;
-            auto y = touch.py - off_y;
-            if(x >= 0 && x <= visible_w && y >= 0 && y < visible_h)
+            int board_x, board_y;
+            if(touch_to_board(touch, board_x, board_y))
             {
-                auto square_x = (x + board_offset_x)/16 - (current_level->warp ? 1 : 0);
-                auto square_y = (y + board_offset_y)/16 - (current_level->warp ? 1 : 0);
-                if(square_x < 0 || square_y < 0 || square_x >= current_level->width || square_y >= current_level->height) return;
-
-                size_t new_idx = square_x + square_y * current_level->width;
-                if(selected_color)
-                {
-                    if(current_level->move_idx_up_checked(playing_cursor_idx) == new_idx)
-                    {
-                        playing_cursor_up();
-                    }
-                    else if(current_level->move_idx_right_checked(playing_cursor_idx) == new_idx)
-                    {
-                        playing_cursor_right();
-                    }
-                    else if(current_level->move_idx_down_checked(playing_cursor_idx) == new_idx)
-                    {
-                        playing_cursor_down();
-                    }
-                    else if(current_level->move_idx_left_checked(playing_cursor_idx) == new_idx)
-                    {
-                        playing_cursor_left();
-                    }
-                }
+                // the stylus can skip squares between two frames, every square under its stroke is visited
+                if(touch_board_x < 0)
+                    queue_square_at(board_x, board_y);
                 else
-                {
-                    playing_cursor_idx = new_idx;
-                }
+                    queue_stroke(touch_board_x, touch_board_y, board_x, board_y);
+                touch_board_x = board_x;
+                touch_board_y = board_y;
+                apply_queued_moves();
             }
         }
         else if(kDown & KEY_B) // exit playing mode
@@ -2015,41 +4711,39 @@ private:
                 selected_color = 0;
             }
         }
-        else if(!play_scaled && (kHeld & KEY_CPAD_LEFT))
+        else if(!conf.circle_pad_cursor && (kHeld & KEY_CPAD_LEFT))
         {
             if(board_offset_x == 0) return;
             board_offset_x--;
         }
-        else if(!play_scaled && (kHeld & KEY_CPAD_RIGHT))
+        else if(!conf.circle_pad_cursor && (kHeld & KEY_CPAD_RIGHT))
         {
-            if(board_offset_x == current_level->get_pixel_width() - 240) return;
+            if(board_offset_x >= max_board_offset_x()) return;
             board_offset_x++;
         }
-        else if(!play_scaled && (kHeld & KEY_CPAD_UP))
+        else if(!conf.circle_pad_cursor && (kHeld & KEY_CPAD_UP))
         {
             if(board_offset_y == 0) return;
             board_offset_y--;
         }
-        else if(!play_scaled && (kHeld & KEY_CPAD_DOWN))
+        else if(!conf.circle_pad_cursor && (kHeld & KEY_CPAD_DOWN))
         {
-            if(board_offset_y == current_level->get_pixel_height() - 240) return;
+            if(board_offset_y >= max_board_offset_y()) return;
             board_offset_y++;
         }
-        else if(kDown & KEY_DRIGHT)
-        {
-            playing_cursor_right();
-        }
-        else if(kDown & KEY_DLEFT)
-        {
-            playing_cursor_left();
-        }
-        else if(kDown & KEY_DDOWN)
-        {
-            playing_cursor_down();
-        }
-        else if(kDown & KEY_DUP)
+        else
         {
-            playing_cursor_up();
+            if(presses == 0) return;
+
+            u8 direction = DIR_WEST;
+            if(cursor_repeat.key == KEY_DRIGHT) direction = DIR_EAST;
+            else if(cursor_repeat.key == KEY_DDOWN) direction = DIR_SOUTH;
+            else if(cursor_repeat.key == KEY_DUP) direction = DIR_NORTH;
+            for(u32 i = 0; i < presses; ++i)
+                queued_moves.push_back({0, direction});
+            apply_queued_moves();
+            if(conf.circle_pad_cursor)
+                keep_cursor_visible();
         }
     }
 
@@ -2064,7 +4758,7 @@ private:
     void draw_info(float w)
     {
         C2D_Image info_img{&info_tex.tex, &info_subtex};
-        C2D_DrawImageAt(info_img,
+        renderer.image(info_img,
                         (w - 512.0f)/2.0f,
                         (240.0f - 256.0f)/2.0f,
                         0.5f,
@@ -2085,38 +4779,21 @@ private:
     }
     void draw_top_select_level()
     {
-        auto drawn_w = (*current_pack)[selected_level].get_pixel_width();
-        auto drawn_h = (*current_pack)[selected_level].get_pixel_height();
-        float scale_x = 1.0f;
-        float scale_y = 1.0f;
-        float off_x = (400.0f - 240.0f)/2.0f;
-        float off_y = 0.0f;
+        if(!shown_preview) return;
+
+        const Level& l = *shown_preview->level;
+        // the preview was shrunk so that neither side goes past 240 pixels
+        const float drawn_w = l.get_pixel_width() * shown_preview->scale_x;
+        const float drawn_h = l.get_pixel_height() * shown_preview->scale_y;
+        const float off_x = (400.0f - drawn_w)/2.0f;
+        const float off_y = (240.0f - drawn_h)/2.0f;
         Tex3DS_SubTexture subtex = {
-            drawn_w, drawn_h,
-            0.0f, 1.0f, 1.0f, 0.0f
+            u16(drawn_w), u16(drawn_h),
+            0.0f, 1.0f, drawn_w/preview_size, 1.0f - drawn_h/preview_size
         };
-        
-        if(drawn_h > 240)
-        {
-            scale_y = 240/float(drawn_h);
-        }
-        else
-        {
-            off_y = (240.0f - float(drawn_h))/2.0f;
-        }
-        subtex.bottom = 1.0f - float(drawn_h)/512.0f;
-        if(drawn_w > 240)
-        {
-            scale_x = 240/float(drawn_w);
-        }
-        else
-        {
-            off_x = (400.0f - float(drawn_w))/2.0f;
-        }
-        subtex.right = float(drawn_w)/512.0f;
 
-        C2D_Image img{&drawn_level_board.tex, &subtex};
-        C2D_DrawImageAt(img, off_x, off_y, 0.5f, nullptr, scale_x, scale_y);
+        C2D_Image img{&shown_preview->board.tex, &subtex};
+        renderer.image(img, off_x, off_y, 0.5f, nullptr);
     }
     void draw_top_play_level()
     {
@@ -2147,38 +4824,29 @@ private:
         float y = -d.rem;
         const float text_x = (320.0f - 256.0f)/2.0f;
 
-        C2D_Sprite left_hide_sprite, right_hide_sprite; // used to hide overflowing text
-
-        C2D_SpriteFromSheet(&left_hide_sprite, sprites, sprites_hide_text_left_idx);
-        C2D_SpriteSetPos(&left_hide_sprite, text_x - 8.0f, y);
-        C2D_SpriteSetDepth(&left_hide_sprite, 0.75f);
-
-        C2D_SpriteFromSheet(&right_hide_sprite, sprites, sprites_hide_text_right_idx);
-        C2D_SpriteSetPos(&right_hide_sprite, text_x + 256.0f - 30.0f + 8.0f, y);
-        C2D_SpriteSetDepth(&right_hide_sprite, 0.75f);
+        // used to hide overflowing text
+        const float left_hide_x = text_x - 8.0f;
+        const float right_hide_x = text_x + 256.0f - 30.0f + 8.0f;
 
         C2D_Image text_img{nullptr, &pack_name_subtex};
-        for(auto& t : pack_name_texes)
+        for(size_t i = 0; i < pack_name_texes.size(); ++i)
         {
             if(pack_idx + idx >= pack_count()) break;
 
-            text_img.tex = &t.tex;
+            text_img.tex = &pack_name_texes[(pack_idx + idx) % pack_name_texes.size()].tex;
 
             if(pack_idx + idx == selected_pack)
             {
-                C2D_DrawImageAt(text_img, text_x, y, 0.25f, &tints.highlight_tint);
-                C2D_DrawImageAt(text_img, text_x - 3.0f, y - 3.0f, 0.5f, &tints.interface_tint);
+                renderer.image(text_img, text_x, y, 0.25f, &tints.highlight_tint);
+                renderer.image(text_img, text_x - 3.0f, y - 3.0f, 0.5f, &tints.interface_tint);
             }
             else
             {
-                C2D_DrawImageAt(text_img, text_x, y, 0.5f, &tints.interface_tint);
+                renderer.image(text_img, text_x, y, 0.5f, &tints.interface_tint);
             }
 
-            C2D_DrawSpriteTinted(&left_hide_sprite, &tints.background_tint);
-            C2D_DrawSpriteTinted(&right_hide_sprite, &tints.background_tint);
-
-            C2D_SpriteMove(&left_hide_sprite, 0.0f, 30.0f);
-            C2D_SpriteMove(&right_hide_sprite, 0.0f, 30.0f);
+            renderer.sprite(sprites_hide_text_left_idx, left_hide_x, y, 0.75f, &tints.background_tint);
+            renderer.sprite(sprites_hide_text_right_idx, right_hide_x, y, 0.75f, &tints.background_tint);
 
             idx++;
             y += 30.0f;
@@ -2192,22 +4860,58 @@ private:
             auto height = get_level_scrollbar_height();
             // pack_selection_offset = bar_top_pos * max_val / max_bar_pos;
             auto bar_pos = pack_selection_offset * (240 - height) / get_max_level_scroll_value();
-            C2D_DrawRectSolid(float(320 - scrollbar_fixed_size), float(bar_pos), 0.5f, float(scrollbar_fixed_size), float(height), conf.interface_color);
+            renderer.rect(float(320 - scrollbar_fixed_size), float(bar_pos), 0.5f, float(scrollbar_fixed_size), float(height), conf.interface_color);
         }
     }
-    void draw_bottom_select_level()
+    // centered in the w by h box at x, y
+    void draw_level_number(size_t number, float x, float y, float w, float h, const C2D_ImageTint* tint)
     {
-        ldiv_t d = ldiv(selected_level, 5 * 6);
-        C2D_Image won_img = C2D_SpriteSheetGetImage(sprites, sprites_won_idx);
-        C2D_Image left_hide_img = C2D_SpriteSheetGetImage(sprites, sprites_hide_text_left_idx);
-        C2D_Image right_hide_img = C2D_SpriteSheetGetImage(sprites, sprites_hide_text_right_idx);
+        char digits[12];
+        const int count = snprintf(digits, sizeof(digits), "%zd", number);
+        float total_w = 0.0f;
+        for(int i = 0; i < count; ++i)
+            total_w += digit_widths[digits[i] - '0'];
+
         Tex3DS_SubTexture subtex = {
-            50, 40,
-            0.0f, 1.0f, 1.0f, 0.0f
+            0, u16(ceilf(digit_height)),
+            0.0f, 1.0f, 0.0f, 1.0f - ceilf(digit_height)/32.0f
+        };
+        C2D_Image img{&digit_atlas.tex, &subtex};
+        float digit_x = x + (w - total_w)/2.0f;
+        const float digit_y = y + (h - digit_height)/2.0f;
+        for(int i = 0; i < count; ++i)
+        {
+            const int digit = digits[i] - '0';
+            subtex.width = u16(ceilf(digit_widths[digit]));
+            subtex.left = float(digit * digit_cell_width)/256.0f;
+            subtex.right = subtex.left + subtex.width/256.0f;
+            renderer.image(img, digit_x, digit_y, 0.5f, tint);
+            digit_x += digit_widths[digit];
+        }
+    }
+    // the level's thumbnail, blown up by the largest whole factor that fits the cell, behind its number
+    void draw_thumbnail(size_t level_idx, float x, float y, float w, float h)
+    {
+        const ThumbnailSlot& slot = thumbnail_slots[thumbnail_slot_of(level_idx)];
+        if(slot.level != &(*current_pack)[level_idx]) return;
+
+        const float scale = std::max(1.0f, floorf(std::min(w / slot.width, h / slot.height)));
+        const float origin_x = (thumbnail_slot_of(level_idx) % 8) * thumbnail_slot_size;
+        const float origin_y = (thumbnail_slot_of(level_idx) / 8) * thumbnail_slot_size;
+        const Tex3DS_SubTexture subtex = {
+            slot.width, slot.height,
+            origin_x / thumbnail_atlas_size, 1.0f - origin_y / thumbnail_atlas_size,
+            (origin_x + slot.width) / thumbnail_atlas_size, 1.0f - (origin_y + slot.height) / thumbnail_atlas_size
         };
-        constexpr float lr = 50.0f/256.0f;
-        constexpr float bt = 40.0f/256.0f;
-        C2D_Image img{&level_grid_presented->tex, &subtex};
+        C2D_Image img{&thumbnail_atlas.tex, &subtex};
+        renderer.image(img, x + (w - slot.width * scale)/2.0f, y + (h - slot.height * scale)/2.0f, 0.3125f, nullptr, scale, scale);
+    }
+    void draw_bottom_select_level()
+    {
+        ldiv_t d = ldiv(selected_level, 5 * 6);
+        constexpr u16 won_img = sprites_won_idx;
+        constexpr u16 left_hide_img = sprites_hide_text_left_idx;
+        constexpr u16 right_hide_img = sprites_hide_text_right_idx;
         size_t presented_quot = d.quot;
         if(level_selection_direction != 0)
             presented_quot += ((level_selection_direction > 0) ? 1 : -1);
@@ -2223,11 +4927,7 @@ private:
                 constexpr float rw = 50.0f - 4;
                 constexpr float rh = 40.0f - 4;
 
-                subtex.left = 3.0f/256.0f + lr * x;
-                subtex.right = subtex.left + lr;
-                subtex.top = 1.0f - bt * y;
-                subtex.bottom = subtex.top - bt;
-                C2D_DrawRectSolid(rx + 2, ry + 2, 0.125f, rw, rh, conf.interface_color);
+                renderer.rect(rx + 2, ry + 2, 0.125f, rw, rh, conf.interface_color);
                 C2D_ImageTint* text_tint = nullptr;
                 if(y * 5 + x == d.rem && !level_selection_moving)
                 {
@@ -2236,17 +4936,17 @@ private:
                 else
                 {
                     text_tint = &tints.interface_tint;
-                    C2D_DrawRectSolid(rx + 2 + 1, ry + 2 + 1, 0.25f, rw - 2, rh- 2, conf.background_color);
+                    renderer.rect(rx + 2 + 1, ry + 2 + 1, 0.25f, rw - 2, rh- 2, conf.background_color);
                 }
+                draw_thumbnail(y * 5 + x + presented_quot * 30, rx + 2 + 1, ry + 2 + 1, rw - 2, rh - 2);
                 if((*current_pack)[y * 5 + x + d.quot * 5 * 6].completed())
-                    C2D_DrawImageAt(won_img, rx + 1, ry + 6, 0.375f, &tints.half_highlight_tint);
-                C2D_DrawImageAt(img, rx + 1, ry + 2, 0.5f, text_tint);
+                    renderer.sprite(won_img, rx + 1, ry + 6, 0.375f, &tints.half_highlight_tint);
+                draw_level_number(y * 5 + x + presented_quot * 30 + 1, rx + 1, ry + 2, 50.0f, 40.0f, text_tint);
             }
         }
 
         if(level_selection_moving)
         {
-            img.tex = &level_grid_hidden->tex;
             for(int y = 0; y < 6; ++y)
             {
                 for(int x = 0; x < 5; ++x)
@@ -2258,11 +4958,7 @@ private:
                     constexpr float rw = 50.0f - 4;
                     constexpr float rh = 40.0f - 4;
 
-                    subtex.left = 3.0f/256.0f + lr * x;
-                    subtex.right = subtex.left + lr;
-                    subtex.top = 1.0f - bt * y;
-                    subtex.bottom = subtex.top - bt;
-                    C2D_DrawRectSolid(rx + 2, ry + 2, 0.125f, rw, rh, conf.interface_color);
+                    renderer.rect(rx + 2, ry + 2, 0.125f, rw, rh, conf.interface_color);
                     C2D_ImageTint* text_tint = nullptr;
                     if(y * 5 + x == d.rem)
                     {
@@ -2271,109 +4967,102 @@ private:
                     else
                     {
                         text_tint = &tints.interface_tint;
-                        C2D_DrawRectSolid(rx + 2 + 1, ry + 2 + 1, 0.25f, rw - 2, rh- 2, conf.background_color);
+                        renderer.rect(rx + 2 + 1, ry + 2 + 1, 0.25f, rw - 2, rh- 2, conf.background_color);
                     }
+                    draw_thumbnail(y * 5 + x + d.quot * 30, rx + 2 + 1, ry + 2 + 1, rw - 2, rh - 2);
                     if((*current_pack)[y * 5 + x + d.quot * 5 * 6].completed())
-                        C2D_DrawImageAt(won_img, rx + 1, ry + 6, 0.375f, &tints.half_highlight_tint);
-                    C2D_DrawImageAt(img, rx + 1, ry + 2, 0.5f, text_tint);
+                        renderer.sprite(won_img, rx + 1, ry + 6, 0.375f, &tints.half_highlight_tint);
+                    draw_level_number(y * 5 + x + d.quot * 30 + 1, rx + 1, ry + 2, 50.0f, 40.0f, text_tint);
                 }
             }
         }
 
         for(int i = 0; i < 240; i += 30)
         {
-            C2D_DrawImageAt(left_hide_img, 0.0f, float(i), 0.75f, &tints.background_tint);
-            C2D_DrawImageAt(right_hide_img, 320.0f - 30.0f, float(i), 0.75f, &tints.background_tint);
+            renderer.sprite(left_hide_img, 0.0f, float(i), 0.75f, &tints.background_tint);
+            renderer.sprite(right_hide_img, 320.0f - 30.0f, float(i), 0.75f, &tints.background_tint);
         }
 
         if(!level_selection_moving)
         {
-            C2D_DrawImageAt(C2D_SpriteSheetGetImage(sprites, sprites_go_back_idx), (30.0f - 24.0f)/2.0f, (30.0f - 24.0f)/2.0f, 1.0f, &tints.interface_tint);
+            renderer.sprite(sprites_go_back_idx, (30.0f - 24.0f)/2.0f, (30.0f - 24.0f)/2.0f, 1.0f, &tints.interface_tint);
             
             if(d.quot != 0)
-                C2D_DrawImageAt(C2D_SpriteSheetGetImage(sprites, sprites_arrow_left_idx), 0.0f + 2.0f, (240.0f - 30.0f)/2.0f, 1.0f, &tints.interface_tint);
+                renderer.sprite(sprites_arrow_left_idx, 0.0f + 2.0f, (240.0f - 30.0f)/2.0f, 1.0f, &tints.interface_tint);
 
             if(size_t((d.quot + 1) * 5 * 6) < current_pack->count)
-                C2D_DrawImageAt(C2D_SpriteSheetGetImage(sprites, sprites_arrow_right_idx), 320.0f - 30.0f - 2.0f, (240.0f - 30.0f)/2.0f, 1.0f, &tints.interface_tint);
+                renderer.sprite(sprites_arrow_right_idx, 320.0f - 30.0f - 2.0f, (240.0f - 30.0f)/2.0f, 1.0f, &tints.interface_tint);
         }
     }
     void draw_bottom_play_level()
     {
         auto drawn_w = current_level->get_pixel_width();
         auto drawn_h = current_level->get_pixel_height();
-        float scale_x = 1.0f;
-        float scale_y = 1.0f;
-        float off_x = (320.0f - 240.0f)/2.0f;
-        float off_y = 0.0f;
-        Tex3DS_SubTexture subtex = {
-            drawn_w, drawn_h,
-            0.0f, 1.0f, 1.0f, 0.0f
-        };
-
-        if(play_scaled) // zoom out the level as necessary to make it fit (not fixed aspect ratio)
+        const float cell = zoom_cells[zoom];
+        const float scale = cell / 16.0f;
+
+        // a window you can move around, made of the parts of the tiles it shows
+        const Level::Area window = board_window();
+        const float off_x = (320.0f - window.w)/2.0f;
+        const float off_y = (240.0f - window.h)/2.0f;
+        for(auto& t : board_tiles)
         {
-            if(drawn_h > 240)
-            {
-                scale_y = 240/float(drawn_h);
-            }
-            else
-            {
-                off_y = (240.0f - float(drawn_h))/2.0f;
-            }
-            subtex.bottom = 1.0f - (float(drawn_h)/512.0f);
-            if(drawn_w > 240)
-            {
-                scale_x = 240/float(drawn_w);
-            }
-            else
-            {
-                off_x = (320.0f - float(drawn_w))/2.0f;
-            }
-            subtex.right = float(drawn_w)/512.0f;
+            if(t.x < 0 || t.zoom != zoom) continue;
+
+            const int tile_x = t.x * board_tile_size;
+            const int tile_y = t.y * board_tile_size;
+            const int x0 = std::max(window.x, tile_x), x1 = std::min(window.x + window.w, tile_x + board_tile_size);
+            const int y0 = std::max(window.y, tile_y), y1 = std::min(window.y + window.h, tile_y + board_tile_size);
+            if(x0 >= x1 || y0 >= y1) continue;
+
+            const Tex3DS_SubTexture subtex = {
+                u16(x1 - x0), u16(y1 - y0),
+                float(x0 - tile_x)/board_tile_size, 1.0f - float(y0 - tile_y)/board_tile_size,
+                float(x1 - tile_x)/board_tile_size, 1.0f - float(y1 - tile_y)/board_tile_size
+            };
+            C2D_Image img{&t.tex.tex, &subtex};
+            renderer.image(img, off_x + (x0 - window.x), off_y + (y0 - window.y), 0.5f, nullptr);
         }
-        else // use a window you can move around
+
+        // squares no color can fill anymore, and the blinking ends of colors that can't be joined anymore
+        auto highlight_square = [&](u16 idx) {
+            ldiv_t d = ldiv(idx, current_level->width);
+            float x = off_x + d.rem * cell + (current_level->warp ? cell : 0.0f) - window.x;
+            float y = off_y + d.quot * cell + (current_level->warp ? cell : 0.0f) - window.y;
+            renderer.rect(x, y, 0.625f, cell, cell, conf.highlight_half_color);
+        };
+        if(analysis.level == current_level)
         {
-            if(drawn_h > 240)
-            {
-                subtex.height = 240;
-                subtex.top = 1.0f - (float(board_offset_y)/512.0f);
-            }
-            else
+            for(const u16 idx : analysis.dead_squares)
             {
-                off_y = (240.0f - float(drawn_h))/2.0f;
+                if(BoardAnalysis::layer_free(*current_level, idx * 2) || BoardAnalysis::layer_free(*current_level, idx * 2 + 1))
+                    highlight_square(idx);
             }
-            subtex.bottom = subtex.top - (float(subtex.height)/512.0f);
-            if(drawn_w > 240)
+            for(u8 color = 1; odd_second && color <= current_level->color_count; ++color)
             {
-                subtex.width = 240;
-                subtex.left = float(board_offset_x)/512.0f;
+                if(!(analysis.stranded_colors & (1 << (color - 1))) || current_level->path_joined(color)) continue;
+                for(const auto& nodes : current_level->paths[color - 1].segments)
+                    highlight_square(nodes.back().idx);
             }
-            else
-            {
-                off_x = (320.0f - float(drawn_w))/2.0f;
-            }
-            subtex.right = subtex.left + (float(subtex.width)/512.0f);
         }
 
-        C2D_Image img{&drawn_level_board.tex, &subtex};
-        C2D_DrawImageAt(img, off_x, off_y, 0.5f, nullptr, scale_x, scale_y);
         C2D_ImageTint* cursor_tint = selected_color == 0 ? (playing_bridge_above ? &tints.interface_tint : &tints.highlight_tint) : &tints.colors_tints[selected_color - 1];
         size_t cursor_img_idx = odd_second ? (2 - (framectr/20)) : (framectr/20);
         ldiv_t d = ldiv(playing_cursor_idx, current_level->width);
-        float cursor_x = off_x + (d.rem * 16.0f + (current_level->warp ? 16.0f : 0.0f) - board_offset_x) * scale_x;
-        float cursor_y = off_y + (d.quot * 16.0f + (current_level->warp ? 16.0f : 0.0f) - board_offset_y) * scale_y;
-        C2D_DrawImageAt(C2D_SpriteSheetGetImage(sprites, sprites_selector0_idx + cursor_img_idx), cursor_x, cursor_y, 0.75f, cursor_tint, scale_x, scale_y);
+        float cursor_x = off_x + d.rem * cell + (current_level->warp ? cell : 0.0f) - window.x;
+        float cursor_y = off_y + d.quot * cell + (current_level->warp ? cell : 0.0f) - window.y;
+        renderer.sprite(sprites_selector0_idx + cursor_img_idx, cursor_x, cursor_y, 0.75f, cursor_tint, scale, scale);
 
-        C2D_DrawRectSolid(0.0f, 0.0f, 0.875f - 0.0625f, 40.0f, 240.0f, conf.background_color);
-        C2D_DrawRectSolid(320.0f - 40.0f, 0.0f, 0.875f - 0.0625f, 40.0f, 240.0f, conf.background_color);
+        renderer.rect(0.0f, 0.0f, 0.875f - 0.0625f, 40.0f, 240.0f, conf.background_color);
+        renderer.rect(320.0f - 40.0f, 0.0f, 0.875f - 0.0625f, 40.0f, 240.0f, conf.background_color);
         float icon_off = (40.0f - 24.0f)/2.0f;
-        C2D_DrawImageAt(C2D_SpriteSheetGetImage(sprites, sprites_go_back_idx), icon_off, icon_off, 0.875f, &tints.interface_tint);
-        C2D_DrawImageAt(C2D_SpriteSheetGetImage(sprites, sprites_reset_idx), icon_off, 240.0f - 40.0f + icon_off, 0.875f, &tints.interface_tint);
+        renderer.sprite(sprites_go_back_idx, icon_off, icon_off, 0.875f, &tints.interface_tint);
+        renderer.sprite(sprites_reset_idx, icon_off, 240.0f - 40.0f + icon_off, 0.875f, &tints.interface_tint);
         if(drawn_w > 240 || drawn_h > 240)
-            C2D_DrawImageAt(C2D_SpriteSheetGetImage(sprites, sprites_scale_idx), 320.0f - 40.0f + icon_off, icon_off, 0.875f, play_scaled ? &tints.interface_tint : &tints.highlight_tint);
+            renderer.sprite(sprites_scale_idx, 320.0f - 40.0f + icon_off, icon_off, 0.875f, zoom != 0 ? &tints.interface_tint : &tints.highlight_tint);
 
-        C2D_DrawImageAt(C2D_SpriteSheetGetImage(sprites, playing_bridge_above ? sprites_bridge_above_idx : sprites_bridge_under_idx), 320.0f - 40.0f + icon_off, 240.0f - 40.0f + icon_off, 0.875f, &tints.highlight_tint);
-        C2D_DrawImageAt(C2D_SpriteSheetGetImage(sprites, sprites_bridge_icon_idx), 320.0f - 40.0f + icon_off, 240.0f - 40.0f + icon_off, 0.875f + 0.0625f, &tints.interface_tint);
+        renderer.sprite((playing_bridge_above ? sprites_bridge_above_idx : sprites_bridge_under_idx), 320.0f - 40.0f + icon_off, 240.0f - 40.0f + icon_off, 0.875f, &tints.highlight_tint);
+        renderer.sprite(sprites_bridge_icon_idx, 320.0f - 40.0f + icon_off, 240.0f - 40.0f + icon_off, 0.875f + 0.0625f, &tints.interface_tint);
     }
 
     static constexpr std::array<DrawFPtr, ModeCount> draw_bottom_funcs{{
@@ -2384,6 +5073,9 @@ private:
         &LevelContainer::draw_bottom_play_level,
     }};
 };
+#ifdef COLORFILLER_PROFILER
+static_assert(FrameProfiler::mode_count == LevelContainer::ModeCount, "profiler mode names out of date");
+#endif
 
 void get_levels(LevelContainer& cont)
 {
@@ -2412,6 +5104,7 @@ void get_levels(LevelContainer& cont)
     if (r != ARCHIVE_OK)
     {
         DEBUGPRINT("archive_read_open_FILE %d\n", r);
+        archive_read_free(a);
         return;
     }
 
@@ -2420,6 +5113,7 @@ void get_levels(LevelContainer& cont)
     while (archive_read_next_header(a, &entry) == ARCHIVE_OK)
     {
         std::string pack_name = archive_entry_pathname(entry);
+        TRACE_SPAN("get_levels entry", pack_name);
         auto size = archive_entry_size(entry);
         owner.resize(size);
         archive_read_data(a, (u8*)owner, size);
@@ -2447,6 +5141,467 @@ void get_levels(LevelContainer& cont)
         cont.current_mode = LevelContainer::Mode::SelectPack;
 }
 
+#if defined(COLORFILLER_SIMULATION) || defined(COLORFILLER_FUZZ)
+// Random boards in the same layout as the levels file, with walls on both sides of every wall and around non-warp boards and holes
+struct LevelGenerator {
+    u32 rng;
+
+    explicit LevelGenerator(u32 seed) : rng(seed)
+    {
+
+    }
+
+    u32 below(u32 n)
+    {
+        // xorshift32
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        return rng % n;
+    }
+
+    std::vector<u8> level()
+    {
+        const u8 w = 2 + below(11), h = 2 + below(11);
+        const bool warp = below(4) == 0;
+        const u16 count = w * h;
+        std::vector<u16> order(count);
+        for(u16 i = 0; i < count; ++i)
+            order[i] = i;
+        for(u16 i = count - 1; i > 0; --i)
+            std::swap(order[i], order[below(i + 1)]);
+
+        const u8 colors = 1 + below(std::min(6, count / 3));
+        auto next = order.begin() + colors * 2;
+        std::vector<u16> bridges(next, next + below(count / 8 + 1));
+        next += bridges.size();
+        std::vector<u16> holes(next, next + below(count / 10 + 1));
+        std::sort(bridges.begin(), bridges.end());
+        std::sort(holes.begin(), holes.end());
+
+        std::map<u16, u8> walls;
+        for(u16 i = 0; !warp && i < count; ++i)
+        {
+            const u8 x = i % w, y = i / w;
+            const u8 border = (y == 0 ? DIR_NORTH : 0) | (x == w - 1 ? DIR_EAST : 0) | (y == h - 1 ? DIR_SOUTH : 0) | (x == 0 ? DIR_WEST : 0);
+            if(border)
+                walls[i] |= border;
+        }
+        for(auto hole : holes)
+        {
+            // holes are walled off like the border
+            const u8 x = hole % w, y = hole / w;
+            walls[hole] |= ALL_DIRS;
+            walls[(hole + count - w) % count] |= DIR_SOUTH;
+            walls[(hole + w) % count] |= DIR_NORTH;
+            walls[y * w + (x + w - 1) % w] |= DIR_EAST;
+            walls[y * w + (x + 1) % w] |= DIR_WEST;
+        }
+        for(u32 i = below(count / 4 + 1); i > 0; --i)
+        {
+            const u16 sq = below(count);
+            if(below(2) && sq % w != w - 1)
+            {
+                walls[sq] |= DIR_EAST;
+                walls[sq + 1] |= DIR_WEST;
+            }
+            else if(sq / w != h - 1)
+            {
+                walls[sq] |= DIR_SOUTH;
+                walls[sq + w] |= DIR_NORTH;
+            }
+        }
+
+        std::vector<u8> data = {'C', 'L', 'F', 'L', w, h, colors, warp};
+        auto add_u32 = [&](u32 v) {
+            for(int i = 0; i < 4; ++i)
+                data.push_back(v >> (8 * i));
+        };
+        auto add_u16 = [&](u16 v) {
+            data.push_back(v & 0xFF);
+            data.push_back(v >> 8);
+        };
+        add_u32(bridges.size());
+        add_u32(holes.size());
+        add_u32(walls.size());
+        for(u8 i = 0; i < colors * 2; ++i)
+            add_u16(order[i]);
+        for(auto b : bridges)
+            add_u16(b);
+        for(auto hole : holes)
+            add_u16(hole);
+        for(auto [sq, dirs] : walls)
+            add_u16(sq | (dirs << 12));
+        return data;
+    }
+
+    void add_pack(LevelContainer& cont, const std::string& name, size_t count)
+    {
+        const size_t start = cont.levels.size();
+        for(size_t i = 0; i < count; ++i)
+        {
+            auto data = level();
+            cont.levels.emplace_back(DataHolder(data.size(), 0, data.data()));
+        }
+        cont.add_level_pack(name, start, count);
+    }
+};
+#endif
+
+#ifdef COLORFILLER_SIMULATION
+// Scripted input stream, one FrameInput per simulated frame at 60 frames per second
+struct InputScript {
+    std::vector<FrameInput> frames;
+
+    void push(u32 down, u32 held, touchPosition touch = {})
+    {
+        FrameInput in;
+        in.kDown = down;
+        in.kHeld = held;
+        in.touch = touch;
+        in.time = u64(frames.size()) * 1000 / 60;
+        frames.push_back(in);
+    }
+
+    InputScript& idle(size_t count = 1)
+    {
+        for(size_t i = 0; i < count; ++i)
+            push(0, 0);
+        return *this;
+    }
+    InputScript& press(u32 keys)
+    {
+        push(keys, keys);
+        return idle();
+    }
+    InputScript& hold(u32 keys, size_t count)
+    {
+        push(keys, keys);
+        for(size_t i = 1; i < count; ++i)
+            push(0, keys);
+        return idle();
+    }
+    InputScript& drag(const std::vector<touchPosition>& points)
+    {
+        for(size_t i = 0; i < points.size(); ++i)
+            push(i == 0 ? KEY_TOUCH : 0, KEY_TOUCH, points[i]);
+        return idle();
+    }
+};
+
+// Drives a headless LevelContainer and measures the logic cost of every frame
+struct Simulation {
+    using Check = std::function<bool(const LevelContainer&, size_t)>;
+
+    LevelContainer& cont;
+    u64 total_ticks = 0;
+    u64 max_ticks = 0;
+    size_t frames_run = 0;
+
+    explicit Simulation(LevelContainer& c) : cont(c)
+    {
+
+    }
+
+    // returns the index of the first frame where check failed, SIZE_MAX if none did
+    size_t run(const InputScript& script, const Check& check = nullptr)
+    {
+        for(size_t i = 0; i < script.frames.size() && cont.keepgoing; ++i)
+        {
+            const u64 start = svcGetSystemTick();
+            cont.update(script.frames[i]);
+            const u64 ticks = svcGetSystemTick() - start;
+
+            total_ticks += ticks;
+            if(ticks > max_ticks)
+                max_ticks = ticks;
+            frames_run++;
+
+            if(check && !check(cont, i))
+                return i;
+        }
+        return SIZE_MAX;
+    }
+
+    void report(const char* name) const
+    {
+        if(frames_run == 0) return;
+
+        const double total_ms = total_ticks / CPU_TICKS_PER_MSEC;
+        DEBUGPRINT("simulation '%s': %zd frames, avg %.2f us, max %.2f us per frame, %.0f frames per second\n",
+            name, frames_run,
+            total_ms * 1000.0 / frames_run, max_ticks / CPU_TICKS_PER_USEC,
+            total_ms > 0.0 ? frames_run * 1000.0 / total_ms : 0.0);
+    }
+};
+
+// the packs of the levels file, or a pack of generated boards when there is none
+static void simulation_levels(LevelContainer& cont)
+{
+    get_levels(cont);
+    if(cont.pack_count() != 0) return;
+
+    LevelGenerator(1).add_pack(cont, "generated", 30);
+    cont.current_mode = LevelContainer::Mode::SelectPack;
+}
+
+// open the levels of the first pack one after the other, draw paths with the cursor and the stylus on each,
+// and hold Y to reset some of them first
+static InputScript simulation_script()
+{
+    InputScript script;
+    script.press(KEY_A).press(KEY_A);
+    for(int round = 0; round < 200; ++round)
+    {
+        if(round % 4 == 3)
+            script.press(KEY_Y).hold(KEY_Y, 200);
+
+        script.press(KEY_A);
+        for(u32 key : {KEY_DRIGHT, KEY_DRIGHT, KEY_DDOWN, KEY_DLEFT, KEY_DDOWN, KEY_DRIGHT, KEY_DUP, KEY_DUP})
+            script.press(key);
+        script.press(KEY_A);
+
+        // boards are centered with 16 pixel squares: the first touch moves the cursor near the middle, the second grabs the square there
+        const u16 x = 160 + (round % 5 - 2) * 16, y = 120 + (round / 5 % 5 - 2) * 16;
+        script.drag({{x, y}});
+        script.drag({{x, y}, {u16(x + 16), y}, {u16(x + 32), y}, {u16(x + 32), u16(y + 16)}, {u16(x + 16), u16(y + 16)}});
+
+        // B drops the path in hand, or goes back to the level select, to pick the next level
+        script.press(KEY_B).press(KEY_B);
+        script.press(KEY_DRIGHT).press(KEY_A);
+    }
+    return script;
+}
+
+// returns the number of failed checks
+size_t run_simulation(Config& conf)
+{
+    RecordingRenderer rec;
+    LevelContainer cont(conf, rec, nullptr, true);
+    simulation_levels(cont);
+
+    Simulation sim(cont);
+    const size_t failed = sim.run(simulation_script(), [](const LevelContainer& c, size_t) {
+        if(c.current_mode != LevelContainer::Mode::PlayLevel)
+            return c.current_mode == LevelContainer::Mode::SelectPack || c.current_mode == LevelContainer::Mode::SelectLevel;
+        return c.playing_cursor_idx < c.current_level->squares.size()
+            && c.selected_color <= c.current_level->color_count;
+    });
+    sim.report("play level");
+    if(failed != SIZE_MAX)
+    {
+        DEBUGPRINT("simulation: state check failed on frame %zd\n", failed);
+        return 1;
+    }
+    return 0;
+}
+
+// Plays the scripted session while recording it, then plays the recording on fresh boards, which must end up the same
+// returns the number of failed checks
+size_t run_replay_check(Config& conf)
+{
+    const std::string path = conf.save_path + ".replay";
+    const InputScript script = simulation_script();
+
+    RecordingRenderer rec;
+    LevelContainer recorded(conf, rec, nullptr, true);
+    simulation_levels(recorded);
+    {
+        ReplayRecorder recorder(path);
+        for(size_t i = 0; i < script.frames.size() && recorded.keepgoing; ++i)
+        {
+            recorder.record(script.frames[i]);
+            recorded.update(script.frames[i]);
+        }
+    }
+
+    LevelContainer replayed(conf, rec, nullptr, true);
+    simulation_levels(replayed);
+    ReplayPlayer player(path);
+    remove(path.c_str());
+    FrameInput input;
+    while(replayed.keepgoing && player.next(input))
+    {
+        const u64 start = svcGetSystemTick();
+        replayed.update(input);
+        player.update_ticks += svcGetSystemTick() - start;
+    }
+    player.report();
+
+    size_t failures = 0;
+    if(replayed.current_mode != recorded.current_mode || replayed.playing_cursor_idx != recorded.playing_cursor_idx)
+    {
+        DEBUGPRINT("replay: ended in mode %d at square %d instead of mode %d at square %d\n",
+            int(replayed.current_mode), replayed.playing_cursor_idx, int(recorded.current_mode), recorded.playing_cursor_idx);
+        ++failures;
+    }
+    for(size_t l = 0; l < recorded.levels.size(); ++l)
+    {
+        const auto& expected = recorded.levels[l].squares;
+        const auto& got = replayed.levels[l].squares;
+        for(size_t sq = 0; sq < expected.size(); ++sq)
+        {
+            if(got[sq].pack_into() != expected[sq].pack_into())
+            {
+                DEBUGPRINT("replay: level %zd square %zd differs from the recorded session\n", l, sq);
+                ++failures;
+                break;
+            }
+        }
+    }
+    return failures;
+}
+#endif
+
+#ifdef COLORFILLER_FUZZ
+// Random operations on random levels and on the real ones, with every board and path invariant checked after each
+// returns the number of failed checks
+size_t run_fuzz(Config& conf)
+{
+    static constexpr size_t random_levels = 2000;
+    static constexpr size_t random_pack_size = 20;
+    static constexpr size_t operations_per_level = 2000;
+    static constexpr size_t round_trips_per_level = 2;
+    static constexpr const char* operation_names[] = {
+        "up", "right", "down", "left", "select", "bridge layer", "undo", "redo", "reset",
+        "stylus stroke", "forced moves", "save and load",
+    };
+
+    RecordingRenderer rec;
+    LevelContainer cont(conf, rec, nullptr, true);
+    get_levels(cont);
+
+    const u32 seed = u32(svcGetSystemTick()) | 1;
+    LevelGenerator gen(seed);
+    auto below = [&](u32 n) {
+        return gen.below(n);
+    };
+
+    size_t operations = 0, levels_run = 0, failures = 0;
+    u64 clock = 0;
+    std::vector<u16> saved;
+    auto fuzz_level = [&](LevelContainer& cont, Level& level) {
+        cont.play_level(&level);
+        ++levels_run;
+        size_t round_trips = 0;
+        for(size_t i = 0; i < operations_per_level; ++i)
+        {
+            const u32 roll = below(100);
+            u32 op = roll < 56 ? roll % 4 : roll < 70 ? 4 : roll < 75 ? 5 : roll < 83 ? 6 : roll < 90 ? 7 : roll < 91 ? 8 : roll < 95 ? 9 : roll < 98 ? 10 : 11;
+            // the save file holds every pack of the container, writing it again and again would be all the run does
+            if(op == 11 && round_trips == round_trips_per_level)
+                op = 4;
+            else if(op == 11)
+                ++round_trips;
+            switch(op)
+            {
+                case 0: cont.playing_cursor_up(); break;
+                case 1: cont.playing_cursor_right(); break;
+                case 2: cont.playing_cursor_down(); break;
+                case 3: cont.playing_cursor_left(); break;
+                case 4: cont.select_square(); break;
+                case 5: cont.playing_bridge_above = !cont.playing_bridge_above; break;
+                case 6: cont.undo_move(); break;
+                case 7: cont.redo_move(); break;
+                case 8: cont.reset_level(); break;
+                case 9:
+                {
+                    // a press, a few drag frames and the release, through update() like the real stylus
+                    // the 40 pixel columns on the sides hold the buttons, leaving the board would end the fuzzing
+                    auto touch_frame = [&](u32 kDown, u32 kHeld) {
+                        FrameInput input;
+                        input.kDown = kDown;
+                        input.kHeld = kHeld;
+                        input.touch.px = 40 + below(240);
+                        input.touch.py = below(240);
+                        input.time = clock += 16;
+                        cont.update(input);
+                    };
+                    touch_frame(KEY_TOUCH, KEY_TOUCH);
+                    for(u32 frame = below(5); frame > 0; --frame)
+                        touch_frame(0, KEY_TOUCH);
+                    touch_frame(0, 0);
+                    break;
+                }
+                case 10:
+                {
+                    // the forced-move assist, run to the end instead of a frame's budget at a time
+                    cont.selected_color = 0;
+                    cont.end_drag();
+                    cont.forced_moves.start();
+                    while(cont.forced_moves.running)
+                        cont.forced_moves.step(level, cont.history);
+                    break;
+                }
+                default:
+                {
+                    // what load_save reads back from the save file must be the board as save wrote it
+                    cont.selected_color = 0;
+                    cont.end_drag();
+                    saved.clear();
+                    for(const auto& s : level.squares)
+                        saved.push_back(s.pack_into());
+                    cont.save();
+                    level.reset_board();
+                    cont.load_save();
+                    level.rebuild_paths();
+                    cont.end_drag();
+                    for(size_t sq = 0; sq < saved.size(); ++sq)
+                    {
+                        if(level.squares[sq].pack_into() != saved[sq])
+                        {
+                            DEBUGPRINT("fuzz: save and load changed square %zd, seed %lu\n", sq, seed);
+                            ++failures;
+                            break;
+                        }
+                    }
+                    break;
+                }
+            }
+            // update() ends the drag once nothing is selected
+            if(cont.selected_color == 0)
+                cont.end_drag();
+            ++operations;
+
+            if(const char* broken = level.broken_invariant())
+            {
+                DEBUGPRINT("fuzz: %s after operation %zd (%s) on level %zd, seed %lu\n", broken, i, operation_names[op], levels_run, seed);
+                ++failures;
+                break;
+            }
+        }
+        level.release_paths();
+        cont.current_level = nullptr;
+    };
+
+    // the round trips write a save file of their own, the player's is never touched
+    const std::string save_path = conf.save_path;
+    conf.save_path = save_path + ".fuzz";
+
+    // the random levels go in small packs, each with a container of its own, so their save file stays small
+    const u64 start = svcGetSystemTick();
+    for(size_t done = 0; done < random_levels; done += random_pack_size)
+    {
+        LevelContainer pack_cont(conf, rec, nullptr, true);
+        gen.add_pack(pack_cont, "fuzz", random_pack_size);
+        for(auto& level : pack_cont.levels)
+            fuzz_level(pack_cont, level);
+    }
+    for(auto& level : cont.levels)
+        fuzz_level(cont, level);
+
+    const double total_ms = (svcGetSystemTick() - start) / CPU_TICKS_PER_MSEC;
+
+    remove(conf.save_path.c_str());
+    conf.save_path = save_path;
+
+    DEBUGPRINT("fuzz: %zd levels, %zd operations, %zd failures, %.0f operations per second, seed %lu\n",
+        levels_run, operations, failures, total_ms > 0.0 ? operations * 1000.0 / total_ms : 0.0, seed);
+    return failures;
+}
+#endif
+
+#ifndef COLORFILLER_HOST
 int main(int argc, char* argv[])
 {
     // Init libs
@@ -2468,13 +5623,45 @@ int main(int argc, char* argv[])
     if (!spritesheet) svcBreak(USERBREAK_PANIC);
 
     C2D_TextBuf textbuf = C2D_TextBufNew(1024);
+#ifdef COLORFILLER_PROFILER
+    C2D_TextBuf profiler_textbuf = C2D_TextBufNew(512);
+#endif
     Config configuration;
 
     { // Scope for automatic deletion of LevelContainer rendertargets before citro deinit
-        LevelContainer levels(configuration, spritesheet, textbuf);
+        C2DRenderer renderer(spritesheet);
+        DamageRenderer damage_renderer(renderer);
+        LevelContainer levels(configuration, damage_renderer, textbuf);
         get_levels(levels);
-        levels.load_save();
+
+        // the system draws on the screens while we're suspended or asleep
+        aptHookCookie apt_cookie;
+        aptHook(&apt_cookie, [](APT_HookType hook, void* param) {
+            if(hook == APTHOOK_ONRESTORE || hook == APTHOOK_ONWAKEUP)
+                static_cast<LevelContainer*>(param)->damage_screens();
+        }, &levels);
+
+        // replays always start from blank boards, so they don't touch the save
+        std::unique_ptr<ReplayRecorder> recorder;
+        std::unique_ptr<ReplayPlayer> player;
+        if(!configuration.replay_play_path.empty())
+            player = std::make_unique<ReplayPlayer>(configuration.replay_play_path);
+        else if(!configuration.replay_record_path.empty())
+            recorder = std::make_unique<ReplayRecorder>(configuration.replay_record_path);
+        const bool use_save = !player && !recorder;
+        if(use_save)
+            levels.load_save();
         DEBUGPRINT("level count: %zd\n", levels.levels.size());
+#ifdef COLORFILLER_RENDER_AUDIT
+        levels.audit_draw_calls();
+#endif
+#ifdef COLORFILLER_SIMULATION
+        run_simulation(configuration);
+        run_replay_check(configuration);
+#endif
+#ifdef COLORFILLER_FUZZ
+        run_fuzz(configuration);
+#endif
 
         // Main loop
         while (aptMainLoop() && levels.keepgoing)
@@ -2482,31 +5669,92 @@ int main(int argc, char* argv[])
             hidScanInput();
 
             // Respond to user input
-            levels.update();
+            FrameInput input = FrameInput::from_hid();
+            if(player)
+            {
+                if(player->next(input))
+                {
+                    const u64 start = svcGetSystemTick();
+                    levels.update(input);
+                    player->update_ticks += svcGetSystemTick() - start;
+                }
+                else
+                {
+                    player->report();
+                    player = nullptr;
+                    levels.update(input);
+                }
+            }
+            else
+            {
+                if(recorder)
+                    recorder->record(input);
+                levels.update(input);
+            }
 
-            // Render the scene
-            C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
+#ifdef COLORFILLER_PROFILER
+            if(hidKeysDown() & KEY_SELECT)
+                profiler.overlay = !profiler.overlay;
+            if(hidKeysDown() & KEY_START)
+                profiler.dump();
+#endif
+#ifdef COLORFILLER_RASTER
+            if(hidKeysDown() & KEY_ZL)
+                levels.dump_level_png(renderer.images);
+            if(hidKeysDown() & KEY_ZR)
+            {
+                levels.benchmark_raster(renderer.images);
+                levels.compare_path_styles(renderer.images);
+            }
+#endif
 
-            // clear first
-            C2D_TargetClear(top, configuration.background_color);
-            C2D_TargetClear(bot, configuration.background_color);
+            // Render the scene
+            {
+                PROFILE_SCOPE(FrameWait);
+                C3D_FrameBegin(C3D_FRAME_SYNCDRAW);
+            }
 
             levels.update_images();
 
-            // draw after
+            // a screen that isn't drawn isn't transferred either, and keeps showing its last picture
+            auto damage = levels.damage(damage_renderer);
+#ifdef COLORFILLER_PROFILER
+            if(profiler.overlay)
+                damage.top = true;
+#endif
+            PROFILE_FRAME(static_cast<int>(levels.current_mode), damage.top + damage.bottom);
 
-            C2D_SceneBegin(top);
+            if(damage.top)
+            {
+                C2D_TargetClear(top, configuration.background_color);
+                C2D_SceneBegin(top);
 
-            levels.draw_top();
+                levels.draw_top();
+#ifdef COLORFILLER_PROFILER
+                profiler.draw_overlay(profiler_textbuf);
+#endif
+            }
 
-            C2D_SceneBegin(bot);
+            if(damage.bottom)
+            {
+                C2D_TargetClear(bot, configuration.background_color);
+                C2D_SceneBegin(bot);
 
-            levels.draw_bottom();
+                levels.draw_bottom();
+            }
 
             C3D_FrameEnd(0);
+#ifdef COLORFILLER_PROFILER
+            profiler.end_frame();
+#endif
         }
 
-        if(levels.played_any)
+        aptUnhook(&apt_cookie);
+
+        if(player)
+            player->report();
+
+        if(levels.played_any && use_save)
         {
             levels.save();
         }
@@ -2517,9 +5765,16 @@ int main(int argc, char* argv[])
         configuration.save_config();
     }
 
+#ifdef COLORFILLER_TRACE
+    tracer.write();
+#endif
+
     // Delete graphics
     C2D_SpriteSheetFree(spritesheet);
     C2D_TextBufDelete(textbuf);
+#ifdef COLORFILLER_PROFILER
+    C2D_TextBufDelete(profiler_textbuf);
+#endif
 
     // Deinit libs
     C2D_Fini();
@@ -2528,3 +5783,29 @@ int main(int argc, char* argv[])
     romfsExit();
     return 0;
 }
+#else
+// The headless checks, built and run on the computer by host/Makefile
+// usage: ColorFiller-host [levels file], the checks play generated boards without one
+int main(int argc, char* argv[])
+{
+    Config configuration;
+    if(argc > 1)
+        configuration.levels_path = argv[1];
+    // in the working directory, the checks remove what they write there
+    configuration.save_path = "ColorFiller-host.sav";
+
+    size_t failures = 0;
+    {
+        RecordingRenderer rec;
+        LevelContainer levels(configuration, rec, nullptr, true);
+        simulation_levels(levels);
+        failures += levels.audit_draw_calls();
+    }
+    failures += run_simulation(configuration);
+    failures += run_replay_check(configuration);
+    failures += run_fuzz(configuration);
+
+    DEBUGPRINT("host checks: %zd failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif